@@ -54,13 +54,72 @@
 //   The recycling pool interface is experimental and may be subject
 // to change.
 //
+//   make_atomic<T>(args...) allocates the atomic_ptr_ref and the object
+// in a single block (atomic_ptr_block) so that the reference counts and
+// the object share one allocation and, for small objects, one cache line.
+// The returned ref is passed to the recycled ref constructors of
+// atomic_ptr or local_ptr, e.g. atomic_ptr<T> p(make_atomic<T>(a, b));
+// The block uses the pool hook to destroy itself, so setPool must not
+// be used on block refs.
+//
+//   atomic_ptr_session is a scoped read session.  It acquires one
+// ephemeral reference per distinct ref it reads and drops them when the
+// session ends, so repeated dereferences of the same atomic_ptr within
+// the session cost a plain load instead of a pair of interlocked updates.
+//
+//   atomic_ptr_ref and atomic_ptr_block storage comes from a per thread
+// free list allocator (atomic_ptr_pool) unless ATOMIC_PTR_NOPOOL is
+// defined.  This is independent of the pool_put_t recycling hook which
+// recycles the ref together with its object.
+//
+//   If double word CAS is not available as a lock-free instruction
+// (no __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16 on a 64 bit target, e.g. no
+// -mcx16) or ATOMIC_PTR_PACKED is defined to 1, a single word
+// representation is used.  The ephemeral count is kept in the high
+// 16 bits of the atomic_ptr word above a 48 bit pointer and both
+// reference counts in one 64 bit word.  Ephemeral counts are then
+// modulo 2^16, so fewer than 65536 local_ptr's may be outstanding
+// against one object.  Ref addresses must fit in 48 bits.  With 5 level
+// paging (LA57) that holds only while nothing maps memory above 47 bits,
+// Linux's default for mmap without a high address hint.  A ref address
+// that doesn't fit aborts.  atomic_ptr_traits reports the representation.
+//
+//   If ATOMIC_PTR_SHARDS is defined non zero, ephemeral references are
+// dropped into one of that many per thread group, cache line separated
+// slots in the atomic_ptr_ref instead of the shared reference counts.
+// The slots are folded into the reference counts when the last
+// atomic_ptr link to the object is dropped, after which drops go to the
+// reference counts directly.  Only refs that start out with a link
+// (atomic_ptr(T *), make_atomic) use the slots.  Acquiring an ephemeral
+// reference (getrefptr) is not sharded, it still updates the atomic_ptr
+// word with an interlocked instruction, so readers contend on acquire
+// and the slots only take the drop half of the traffic.  Use
+// atomic_ptr_hazard (ATOMIC_PTR_SMR) to avoid the acquire update too.
+//
+//   If ATOMIC_PTR_SMR is defined, refs whose counts go to zero are not
+// deleted right away but handed to fastsmr (smr_defer) and deleted or
+// recycled once no hazard pointer references them.  atomic_ptr_hazard
+// then reads an atomic_ptr by publishing the ref in a hazard pointer
+// instead of acquiring an ephemeral reference, i.e. a plain store and
+// a reload in place of the interlocked update in getrefptr.  fastsmr
+// must be started (rcu_startup) and reading threads registered with it.
+//
 //------------------------------------------------------------------------------
 
 #ifndef _ATOMIC_PTR_H
 #define _ATOMIC_PTR_H
 
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <stdatomic.h>
+#include <new>
+#include <utility>
+
+#ifdef ATOMIC_PTR_SMR
+#include <fastsmr.h>
+#endif
 
 // Membar defines for atomic_ptr load w/ memory_order_acquire semantics
 #define MEMBAR0 memory_order_acquire
@@ -72,6 +131,55 @@
 template<typename T> class atomic_ptr;
 template<typename T> class local_ptr;
 template<typename T> class atomic_ptr_ref;
+template<typename T> class atomic_ptr_block;
+template<typename T, int N = 8> class atomic_ptr_session;
+template<typename T> class atomic_ptr_hazard;
+
+// single word representation if double word CAS isn't lock-free
+#ifndef ATOMIC_PTR_PACKED
+#if __SIZEOF_POINTER__ == 8 && !defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+#define ATOMIC_PTR_PACKED 1
+#else
+#define ATOMIC_PTR_PACKED 0
+#endif
+#endif
+
+#if ATOMIC_PTR_PACKED
+
+#if __SIZEOF_POINTER__ != 8
+#error "atomic_ptr: packed representation requires 64 bit pointers"
+#endif
+
+// single word sized integer type for interlocked updates
+#define ival int64_t
+
+#define ECOUNT_SHIFT	48
+#define ECOUNT_ONE		((uintptr_t)1 << ECOUNT_SHIFT)
+#define PTR_MASK		(ECOUNT_ONE - 1)
+#define ECOUNT_ZERO(e)	(((e) & 0xffff) == 0)	// ephemeral counts modulo 2^16
+
+struct refcount {
+	uint32_t	ecount;	// ephemeral count (modulo 2^16)
+	int32_t		rcount;	// reference count
+};
+
+//
+// Differential reference to allow race free access to reference count
+//   ecount:16 | ptr:48
+//
+template<typename T> struct differentialReference {
+	uintptr_t	word;
+
+	long getCount() const { return (long)(word >> ECOUNT_SHIFT); }
+	atomic_ptr_ref<T> * getPtr() const { return (atomic_ptr_ref<T> *)(word & PTR_MASK); }
+	void set(atomic_ptr_ref<T> * p, long ecount = 0) {
+		if (((uintptr_t)p & ~PTR_MASK) != 0)
+			abort();	// ref above 48 bits, e.g. LA57 high mapping
+		word = ((uintptr_t)ecount << ECOUNT_SHIFT) | (uintptr_t)p;
+	}
+};
+
+#else
 
 // double word sized integer type to get around illogical c11 atomics restriction
 #if __SIZEOF_LONG__ == 8
@@ -80,6 +188,7 @@ template<typename T> class atomic_ptr_ref;
 #define ival int64_t
 #endif
 
+#define ECOUNT_ZERO(e)	((e) == 0)
 
 struct refcount {
 	long	ecount;	// ephemeral count
@@ -92,11 +201,281 @@ struct refcount {
 template<typename T> struct differentialReference {
 	long	ecount; // ephemeral count
 	atomic_ptr_ref<T> *ptr;
+
+	long getCount() const { return ecount; }
+	atomic_ptr_ref<T> * getPtr() const { return ptr; }
+	void set(atomic_ptr_ref<T> * p, long count = 0) { ecount = count; ptr = p; }
 };
 
+#endif
+
+// gcc reports 16 byte atomics as not always lock-free even with -mcx16
+// (they go through libatomic), so go by the cmpxchg16b macro instead
+#if ATOMIC_PTR_PACKED || __SIZEOF_LONG__ != 8
+#define ATOMIC_PTR_LOCK_FREE	__atomic_always_lock_free(sizeof(ival), 0)
+#elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+#define ATOMIC_PTR_LOCK_FREE	true
+#else
+#define ATOMIC_PTR_LOCK_FREE	false
+#endif
+
+//-----------------------------------------------------------------------------
+// atomic_ptr_traits -- active representation
+//-----------------------------------------------------------------------------
+struct atomic_ptr_traits {
+	static constexpr bool	packed = ATOMIC_PTR_PACKED;	// single word representation
+	static constexpr size_t	width = sizeof(ival);		// interlocked update size
+	static constexpr bool	lock_free = ATOMIC_PTR_LOCK_FREE;
+};
+
+#if ATOMIC_PTR_PACKED
+static_assert(atomic_ptr_traits::lock_free, "atomic_ptr: single word CAS is not lock-free");
+#elif defined(ATOMIC_PTR_REQUIRE_LOCKFREE)
+static_assert(atomic_ptr_traits::lock_free, "atomic_ptr: double word CAS is not lock-free, define ATOMIC_PTR_PACKED");
+#endif
+
 typedef void (*pool_put_t)(void *);
 
 
+#ifndef ATOMIC_PTR_SHARDS
+#define ATOMIC_PTR_SHARDS 0			// ephemeral drop slots per ref, 0 = none
+#endif
+#ifndef ATOMIC_PTR_CACHE_LINE
+#define ATOMIC_PTR_CACHE_LINE 64
+#endif
+
+#if ATOMIC_PTR_SHARDS
+#define SHARD_CLOSED LONG_MIN		// slot folded into reference counts
+
+//-----------------------------------------------------------------------------
+// atomic_ptr_shard -- per thread slot index, assigned round robin
+//-----------------------------------------------------------------------------
+inline int atomic_ptr_shard() {
+	static thread_local int ndx = -1;
+	static int next = 0;
+
+	if (ndx < 0)
+		ndx = (int)((unsigned int)atomic_fetch_add_explicit(&next, 1, memory_order_relaxed) % ATOMIC_PTR_SHARDS);
+	return ndx;
+}
+#endif
+
+
+#ifndef ATOMIC_PTR_POOL_GRANULE
+#define ATOMIC_PTR_POOL_GRANULE 64		// size class granularity
+#endif
+#ifndef ATOMIC_PTR_POOL_CLASSES
+#define ATOMIC_PTR_POOL_CLASSES 16		// number of size classes
+#endif
+#ifndef ATOMIC_PTR_POOL_DEPTH
+#define ATOMIC_PTR_POOL_DEPTH 256		// max free blocks kept per size class
+#endif
+
+//=============================================================================
+// atomic_ptr_pool -- per thread size class free list allocator
+//
+// Each thread allocates from and frees to its own free lists w/o any
+// interlocked instructions.  Blocks freed by another thread are pushed
+// onto the owning pool's remote free list, which the owner takes over in
+// one exchange when its free list runs empty.  When the owning thread
+// exits the pool stays around until all of its blocks have been freed.
+//=============================================================================
+class atomic_ptr_pool {
+	private:
+		struct header {
+			atomic_ptr_pool *	owner;		// owning pool, null if not pooled
+			size_t				sizeClass;	// size class index
+		};								// preserves malloc alignment
+
+		struct block {
+			header			hdr;
+			block *			next;		// free list link, overlays user data
+		};
+
+		block *		freeList[ATOMIC_PTR_POOL_CLASSES];	// owner only
+		long		freeCount[ATOMIC_PTR_POOL_CLASSES];
+		block *		remoteList;		// blocks freed by other threads
+		long		live;			// allocated blocks + 1 for owner thread
+		bool		dead;			// owner thread has exited
+
+		//----------------------------------------------------------------------
+		// thread exit hook
+		//----------------------------------------------------------------------
+		struct thread_pool {
+			atomic_ptr_pool *	pool;
+
+			thread_pool() {
+				pool = (atomic_ptr_pool *)malloc(sizeof(atomic_ptr_pool));
+				if (pool == nullptr)
+					throw std::bad_alloc();
+				for (int j = 0; j < ATOMIC_PTR_POOL_CLASSES; j++) {
+					pool->freeList[j] = nullptr;
+					pool->freeCount[j] = 0;
+				}
+				pool->remoteList = nullptr;
+				pool->live = 1;
+				pool->dead = false;
+				current() = pool;
+			}
+
+			~thread_pool() {
+				current() = nullptr;
+				exiting() = true;
+				pool->shutdown();
+			}
+		};
+
+		// trivially destructible, usable during thread exit
+		static atomic_ptr_pool * & current() {
+			static thread_local atomic_ptr_pool * pool = nullptr;
+			return pool;
+		}
+
+		static bool & exiting() {
+			static thread_local bool flag = false;
+			return flag;
+		}
+
+		static atomic_ptr_pool * local() {
+			if (exiting())
+				return nullptr;
+			static thread_local thread_pool self;
+			return self.pool;
+		}
+
+		void release(long n) {
+			if (atomic_fetch_sub_explicit(&live, n, memory_order_acq_rel) == n)
+				::free(this);
+		}
+
+		// owner takes over remote free list
+		bool collect() {
+			block * list = atomic_exchange_explicit(&remoteList, (block *)nullptr, memory_order_acquire);
+			block * b;
+
+			if (list == nullptr)
+				return false;
+
+			while ((b = list) != nullptr) {
+				list = b->next;
+				putLocal(b);
+			}
+			return true;
+		}
+
+		// free remote free list, owner thread has exited
+		void drain() {
+			block * list = atomic_exchange_explicit(&remoteList, (block *)nullptr, memory_order_seq_cst);
+			block * b;
+			long n = 0;
+
+			while ((b = list) != nullptr) {
+				list = b->next;
+				::free(b);
+				n++;
+			}
+			if (n != 0)
+				release(n);
+		}
+
+		void putLocal(block * b) {
+			size_t c = b->hdr.sizeClass;
+
+			if (freeCount[c] < ATOMIC_PTR_POOL_DEPTH) {
+				b->next = freeList[c];
+				freeList[c] = b;
+				freeCount[c]++;
+			}
+			else {
+				::free(b);
+				release(1);
+			}
+		}
+
+		void putRemote(block * b) {
+			atomic_fetch_add_explicit(&live, 1, memory_order_relaxed);		// hold pool
+
+			b->next = atomic_load_explicit(&remoteList, memory_order_relaxed);
+			while (!atomic_compare_exchange_weak_explicit(&remoteList, &b->next, b, memory_order_seq_cst, memory_order_relaxed));
+
+			// owner may have exited before seeing this block
+			if (atomic_load_explicit(&dead, memory_order_seq_cst))
+				drain();
+
+			release(1);
+		}
+
+		void shutdown() {
+			block * b;
+			long n = 0;
+
+			atomic_store_explicit(&dead, true, memory_order_seq_cst);
+
+			for (int j = 0; j < ATOMIC_PTR_POOL_CLASSES; j++) {
+				while ((b = freeList[j]) != nullptr) {
+					freeList[j] = b->next;
+					::free(b);
+					n++;
+				}
+				freeCount[j] = 0;
+			}
+
+			drain();
+			release(n + 1);		// drop owner reference
+		}
+
+	public:
+
+		static void * alloc(size_t sz) {
+			size_t c = (sz + sizeof(header) + ATOMIC_PTR_POOL_GRANULE - 1) / ATOMIC_PTR_POOL_GRANULE;
+			atomic_ptr_pool * pool = nullptr;
+			block * b;
+
+			if (c <= ATOMIC_PTR_POOL_CLASSES && (pool = local()) != nullptr) {
+				c--;
+				if ((b = pool->freeList[c]) != nullptr || (pool->collect() && (b = pool->freeList[c]) != nullptr)) {
+					pool->freeList[c] = b->next;
+					pool->freeCount[c]--;
+					return &b->next;
+				}
+
+				if ((b = (block *)malloc((c + 1) * ATOMIC_PTR_POOL_GRANULE)) == nullptr)
+					throw std::bad_alloc();
+				atomic_fetch_add_explicit(&pool->live, 1, memory_order_relaxed);
+			}
+
+			else {
+				// too large or thread exiting, not pooled
+				if ((b = (block *)malloc(sizeof(header) + sz)) == nullptr)
+					throw std::bad_alloc();
+				pool = nullptr;
+				c = 0;
+			}
+
+			b->hdr.owner = pool;
+			b->hdr.sizeClass = c;
+			return &b->next;
+		}
+
+		static void dealloc(void * p) {
+			block * b;
+			atomic_ptr_pool * pool;
+
+			if (p == nullptr)
+				return;
+
+			b = (block *)((char *)p - sizeof(header));
+			if ((pool = b->hdr.owner) == nullptr)
+				::free(b);
+			else if (pool == current())
+				pool->putLocal(b);
+			else
+				pool->putRemote(b);
+		}
+
+}; // class atomic_ptr_pool
+
+
 //=============================================================================
 // atomic_ptr_ref -- non intrusive reference count
 //
@@ -105,19 +484,46 @@ typedef void (*pool_put_t)(void *);
 template<typename T> class atomic_ptr_ref {
 	friend class atomic_ptr<T>;
 	friend class local_ptr<T>;
+	friend class atomic_ptr_block<T>;
+	template<typename U, int N> friend class atomic_ptr_session;
+	friend class atomic_ptr_hazard<T>;
 
 	private:
 		refcount	count;				// reference counts
 		T *			ptr;				// ptr to actual object
 		pool_put_t	pool;
+#ifdef ATOMIC_PTR_SMR
+		rcu_defer_t	defer;				// deferred reclamation
+#endif
 
 	public:
 		atomic_ptr_ref<T> * next;
 
+	private:
+#if ATOMIC_PTR_SHARDS
+		struct shard {
+			long	count;		// dropped ephemeral references (<= 0) or SHARD_CLOSED
+			char	pad[ATOMIC_PTR_CACHE_LINE - sizeof(long)];
+		};
+
+		char		pad0[ATOMIC_PTR_CACHE_LINE];			// off the reference count line
+		shard		shards[ATOMIC_PTR_SHARDS];
+#endif
+
+	public:
+#ifndef ATOMIC_PTR_NOPOOL
+		static void * operator new (size_t sz) { return atomic_ptr_pool::alloc(sz); }
+		static void operator delete (void * p) { atomic_ptr_pool::dealloc(p); }
+#if __cpp_aligned_new
+		// over aligned objects in atomic_ptr_block bypass the pool
+		static void * operator new (size_t sz, std::align_val_t al) { return ::operator new(sz, al); }
+		static void operator delete (void * p, std::align_val_t al) { ::operator delete(p, al); }
+#endif
+#endif
+
 
 		atomic_ptr_ref(T * p = nullptr) {
-			count.ecount = 0;
-			count.rcount = 1;
+			reset(0, 1);
 			ptr = p;
 			pool = nullptr;
 			next = nullptr;
@@ -130,6 +536,105 @@ template<typename T> class atomic_ptr_ref {
 
 	private:
 
+		//----------------------------------------------------------------------
+		// dispose -- reference counts went to zero, delete or recycle the
+		// ref, after any hazard pointers to it are gone if ATOMIC_PTR_SMR.
+		//----------------------------------------------------------------------
+		void dispose() {
+#ifdef ATOMIC_PTR_SMR
+			defer.func = &reclaim;
+			defer.arg = this;				// hazard pointer value
+			defer.forrefs = &forrefs;
+			defer.psequence = nullptr;
+			defer.type = trace;
+			defer.state = live;
+			defer.next = nullptr;
+			smr_defer(&defer);
+#else
+			reclaim(this);
+#endif
+		}
+
+		static void reclaim(void * arg) {
+			atomic_ptr_ref<T> * refptr = (atomic_ptr_ref<T> *)arg;
+
+			if (refptr->pool == nullptr)
+				delete refptr;
+			else
+				refptr->pool(refptr);		// recycle to pool
+		}
+
+#ifdef ATOMIC_PTR_SMR
+		// no deferred refs reachable from a ref
+		static void forrefs(void *, refcb_t) {}
+#endif
+
+		//----------------------------------------------------------------------
+		// reset -- set refcounts of a new or recycled ref, no other
+		// references may exist.  Drop slots are only used while the
+		// ref is linked.
+		//----------------------------------------------------------------------
+		void reset(long xephemeralCount, long xreferenceCount) {
+			count.ecount = xephemeralCount;
+			count.rcount = xreferenceCount;
+#if ATOMIC_PTR_SHARDS
+			for (int j = 0; j < ATOMIC_PTR_SHARDS; j++)
+				shards[j].count = (xreferenceCount != 0) ? 0 : SHARD_CLOSED;
+#endif
+		}
+
+		//----------------------------------------------------------------------
+		// drop -- drop ephemeral references
+		//
+		// While the drop slots are open, a link reference is still held
+		// or the last link is being dropped and its unlink will fold the
+		// slot, so the counts can't go to zero here.
+		//
+		// returns 0 if reference counts went to zero
+		//----------------------------------------------------------------------
+		int drop(long xephemeralCount) {
+#if ATOMIC_PTR_SHARDS
+			long * slot = &shards[atomic_ptr_shard()].count;
+			long oldval = atomic_load_explicit(slot, memory_order_relaxed);
+
+			while (oldval != SHARD_CLOSED) {
+				if (atomic_compare_exchange_weak_explicit(slot, &oldval, oldval - xephemeralCount, memory_order_release, memory_order_relaxed))
+					return 1;
+			}
+#endif
+			return adjust_mb(-xephemeralCount, 0);
+		}
+
+		//----------------------------------------------------------------------
+		// unlink -- drop link reference along with the link's ephemeral count
+		//
+		// returns 0 if reference counts went to zero
+		//----------------------------------------------------------------------
+		int unlink(long xephemeralCount) {
+#if ATOMIC_PTR_SHARDS
+			refcount newval;
+			long sum = 0;
+			long temp;
+
+			if (adjust_mb(xephemeralCount, -1, newval) == 0)
+				return 0;
+
+			if (newval.rcount != 0)
+				return 1;
+
+			// last link, close drop slots and fold them into the refcounts
+			for (int j = 0; j < ATOMIC_PTR_SHARDS; j++) {
+				temp = atomic_exchange_explicit(&shards[j].count, SHARD_CLOSED, memory_order_acquire);
+				if (temp != SHARD_CLOSED)
+					sum += temp;
+			}
+
+			return (sum != 0) ? adjust_mb(sum, 0) : 1;
+#else
+			return adjust_mb(xephemeralCount, -1);
+#endif
+		}
+
 		//----------------------------------------------------------------------
 		// adjust -- adjust refcounts
 		//
@@ -142,7 +647,12 @@ template<typename T> class atomic_ptr_ref {
 		// Adding references does not require membars.
 		//----------------------------------------------------------------------
 		int adjust_mb(long xephemeralCount, long xreferenceCount) {
-			refcount oldval, newval;
+			refcount newval;
+			return adjust_mb(xephemeralCount, xreferenceCount, newval);
+		}
+
+		int adjust_mb(long xephemeralCount, long xreferenceCount, refcount & newval) {
+			refcount oldval;
 
 			oldval.ecount = count.ecount;
 			oldval.rcount = count.rcount;
@@ -150,9 +660,9 @@ template<typename T> class atomic_ptr_ref {
 				newval.ecount = oldval.ecount + xephemeralCount;
 				newval.rcount = oldval.rcount + xreferenceCount;
 			}
-			while (!atomic_compare_exchange_strong_explicit((ival*)&count, (ival*)&oldval, (ival)newval, memory_order_acq_rel, memory_order_relaxed));
+			while (!atomic_compare_exchange_strong_explicit((ival*)&count, (ival*)&oldval, *(ival*)&newval, memory_order_acq_rel, memory_order_relaxed));
 
-			return (newval.ecount == 0 && newval.rcount == 0) ? 0 : 1;
+			return (ECOUNT_ZERO(newval.ecount) && newval.rcount == 0) ? 0 : 1;
 		}
 
 		//----------------------------------------------------------------------
@@ -167,14 +677,55 @@ template<typename T> class atomic_ptr_ref {
 				newval.ecount = oldval.ecount + xephemeralCount;
 				newval.rcount = oldval.rcount + xreferenceCount;
 			}
-			while (!atomic_compare_exchange_strong_explicit((ival*)&count, (ival*)&oldval, (ival)newval, memory_order_relaxed, memory_order_relaxed));
+			while (!atomic_compare_exchange_strong_explicit((ival*)&count, (ival*)&oldval, *(ival*)&newval, memory_order_relaxed, memory_order_relaxed));
 
-			return (newval.ecount == 0 && newval.rcount == 0) ? 0 : 1;
+			return (ECOUNT_ZERO(newval.ecount) && newval.rcount == 0) ? 0 : 1;
 		}
 
 }; // class atomic_ptr_ref
 
 
+//=============================================================================
+// atomic_ptr_block -- intrusive reference count
+//
+// atomic_ptr_ref and object allocated together.  The object is constructed
+// in place after the reference counts and destroyed in place when the
+// counts go to zero, via the pool hook, instead of being deleted.
+//=============================================================================
+template<typename T> class atomic_ptr_block : public atomic_ptr_ref<T> {
+	public:
+
+		template<typename... Args> atomic_ptr_block(Args&&... args) : atomic_ptr_ref<T>(nullptr) {
+			this->ptr = new (&storage) T(std::forward<Args>(args)...);
+			this->pool = &release;
+		}
+
+	private:
+		alignas(T) unsigned char storage[sizeof(T)];	// in place object
+
+		//----------------------------------------------------------------------
+		// release -- pool hook, destroy object in place and free block
+		//----------------------------------------------------------------------
+		static void release(void * p) {
+			atomic_ptr_block<T> * block = (atomic_ptr_block<T> *)p;
+			block->ptr->~T();
+			block->ptr = nullptr;		// ~atomic_ptr_ref deletes ptr
+			delete block;
+		}
+
+}; // class atomic_ptr_block
+
+
+//-----------------------------------------------------------------------------
+// make_atomic -- allocate ref and object in one block
+//
+// returns ref with rcount of 1 for the recycled ref constructors
+//-----------------------------------------------------------------------------
+template<typename T, typename... Args> inline atomic_ptr_ref<T> * make_atomic(Args&&... args) {
+	return new atomic_ptr_block<T>(std::forward<Args>(args)...);
+}
+
+
 //=============================================================================
 // local_ptr
 //
@@ -187,8 +738,7 @@ template<typename T> class local_ptr {
 		local_ptr(T * obj = nullptr) {
 			if (obj != nullptr) {
 				refptr = new atomic_ptr_ref<T>(obj);
-				refptr->count.ecount = 1;
-				refptr->count.rcount = 0;
+				refptr->reset(1, 0);
 			}
 			else
 				refptr = nullptr;
@@ -199,6 +749,11 @@ template<typename T> class local_ptr {
 				refptr->adjust(+1, 0);
 		}
 
+		local_ptr(local_ptr<T> && src) {	// move constructor
+			refptr = src.refptr;
+			src.refptr = nullptr;
+		}
+
 		local_ptr(atomic_ptr<T> & src) {
 			refptr = src.getrefptr();
 		}
@@ -206,20 +761,14 @@ template<typename T> class local_ptr {
 		// recycled ref object
 		local_ptr(atomic_ptr_ref<T>  * src) {
 			refptr = src;
-			if (refptr != nullptr) {
-				refptr->count.ecount = 1;
-				refptr->count.rcount = 0;
-			}
+			if (refptr != nullptr)
+				refptr->reset(1, 0);
 			// pool unchanged
 		}
 
 		~local_ptr() {
-			if (refptr != nullptr && refptr->adjust_mb(-1, 0) == 0) {
-				if (refptr->pool == nullptr)
-					delete refptr;
-				else
-					refptr->pool(refptr);		// recyle to pool
-			}
+			if (refptr != nullptr && refptr->drop(1) == 0)
+				refptr->dispose();
 		}
 		
 		local_ptr<T> & operator = (T * obj) {
@@ -234,12 +783,29 @@ template<typename T> class local_ptr {
 			return *this;
 		}
 
+		local_ptr<T> & operator = (local_ptr<T> && src) {
+			local_ptr<T> temp(std::move(src));
+			swap(temp);	// non-atomic
+			return *this;
+		}
+
 		local_ptr<T> & operator = (atomic_ptr<T> & src) {
 			local_ptr<T> temp(src);
 			swap(temp);	// non-atomic
 			return *this;
 		}
 
+		//-----------------------------------------------------------------
+		// release -- give up the ref w/o adjusting the reference counts.
+		// The caller owns the ephemeral reference.  If it was the only
+		// reference the ref may be passed to a recycled ref constructor.
+		//-----------------------------------------------------------------
+		atomic_ptr_ref<T> * release() {
+			atomic_ptr_ref<T> * temp = refptr;
+			refptr = nullptr;
+			return temp;
+		}
+
 
 		T * get() {
 			return (refptr != nullptr) ? atomic_load_explicit(&refptr->ptr, MEMBAR1) : (T *)nullptr;
@@ -255,8 +821,8 @@ template<typename T> class local_ptr {
 		// refptr == rhd.refptr  iff  refptr->ptr == rhd.refptr->ptr
 		bool operator == (local_ptr<T> & rhd) { return (refptr == rhd.refptr);}
 		bool operator != (local_ptr<T> & rhd) { return (refptr != rhd.refptr);}
-		bool operator == (atomic_ptr<T> & rhd) { return (refptr == rhd.ref.ptr);}
-		bool operator != (atomic_ptr<T> & rhd) { return (refptr != rhd.ref.ptr);}
+		bool operator == (atomic_ptr<T> & rhd) { return (refptr == rhd.ref.getPtr());}
+		bool operator != (atomic_ptr<T> & rhd) { return (refptr != rhd.ref.getPtr());}
 
 		//-----------------------------------------------------------------
 		// set/get recycle pool methods
@@ -313,6 +879,8 @@ template<typename T> inline bool operator != (T * lhd, local_ptr<T> & rhd)
 //=============================================================================
 template<typename T> class atomic_ptr {
 	friend class local_ptr<T>;
+	template<typename U, int N> friend class atomic_ptr_session;
+	friend class atomic_ptr_hazard<T>;
 
 	protected:
 		differentialReference<T>  ref;
@@ -320,48 +888,57 @@ template<typename T> class atomic_ptr {
 	public:
 
 		atomic_ptr(T * obj = nullptr) {
-			ref.ecount = 0;
 			if (obj != nullptr) {
-				ref.ptr = new atomic_ptr_ref<T>(obj);
+				ref.set(new atomic_ptr_ref<T>(obj));
 			}
 			else
-				ref.ptr = nullptr;
+				ref.set(nullptr);
 		}
 
 		atomic_ptr(local_ptr<T> & src) {	// copy constructor
-			ref.ecount = 0;
-			if ((ref.ptr = src.refptr) != nullptr)
-				ref.ptr->adjust(0, +1);
+			ref.set(src.refptr);
+			if (src.refptr != nullptr)
+				src.refptr->adjust(0, +1);
+		}
+
+		atomic_ptr(local_ptr<T> && src) {	// move constructor
+			atomic_ptr_ref<T> * refptr = src.release();
+
+			ref.set(refptr);
+			// convert ephemeral reference to link reference
+			if (refptr != nullptr)
+				refptr->adjust(-1, +1);	// atomic
 		}
 
 		atomic_ptr(atomic_ptr<T> & src) {  // copy constructor
-			ref.ecount = 0;
-			ref.ptr = src.getrefptr();	// atomic 
+			atomic_ptr_ref<T> * refptr = src.getrefptr();	// atomic
 
+			ref.set(refptr);
 			// adjust link count
-			if (ref.ptr != nullptr)
-				ref.ptr->adjust(-1, +1);	// atomic
+			if (refptr != nullptr)
+				refptr->adjust(-1, +1);	// atomic
+		}
+
+		atomic_ptr(atomic_ptr<T> && src) {  // move constructor, src is local & non-shared
+			ref = src.ref;
+			src.ref.set(nullptr);
 		}
 
 		// recycled ref objects
 		atomic_ptr(atomic_ptr_ref<T> * src) { // copy constructor
-			if (src != nullptr) {
-				src->count.ecount = 0;
-				src->count.rcount = 1;
-			}
-			ref.ecount = 0;
-			ref.ptr = src;	// atomic 
+			if (src != nullptr)
+				src->reset(0, 1);
+			ref.set(src);	// atomic 
 		}
 
 
 		~atomic_ptr() {					// destructor
+			atomic_ptr_ref<T> * refptr = ref.getPtr();
+
 			atomic_thread_fence(memory_order_release);
-			if (ref.ptr != nullptr && ref.ptr->adjust_mb(ref.ecount, -1) == 0) {
+			if (refptr != nullptr && refptr->unlink(ref.getCount()) == 0) {
 				atomic_thread_fence(memory_order_acquire);
-				if (ref.ptr->pool == nullptr)
-					delete ref.ptr;
-				else
-					ref.ptr->pool(ref.ptr);
+				refptr->dispose();
 			}
 		}
 
@@ -383,6 +960,18 @@ template<typename T> class atomic_ptr {
 			return *this;
 		}
 
+		atomic_ptr & operator = (local_ptr<T> && src) {
+			atomic_ptr<T> temp(std::move(src));
+			swap(temp);					// atomic
+			return *this;
+		}
+
+		atomic_ptr & operator = (atomic_ptr<T> && src) {
+			atomic_ptr<T> temp(std::move(src));
+			swap(temp);					// atomic
+			return *this;
+		}
+
 		
 		//-----------------------------------------------------------------
 		// generate local temp ptr to guarantee validity of ptr
@@ -394,14 +983,14 @@ template<typename T> class atomic_ptr {
 
 		bool operator == (T * rhd) {
 			if (rhd == nullptr)
-				return (ref.ptr == nullptr);
+				return (peekrefptr() == nullptr);
 			else
 				return (local_ptr<T>(*this) == rhd);
 		}
 
 		bool operator != (T * rhd) {
 			if (rhd == nullptr)
-				return (ref.ptr != nullptr);
+				return (peekrefptr() != nullptr);
 			else
 				return (local_ptr<T>(*this) != rhd);
 		}
@@ -411,12 +1000,21 @@ template<typename T> class atomic_ptr {
 		bool operator == (atomic_ptr<T> & rhd) {return (local_ptr<T>(*this) == local_ptr<T>(rhd)); }
 		bool operator != (atomic_ptr<T> & rhd) {return (local_ptr<T>(*this) != local_ptr<T>(rhd)); }
 
-		bool cas(local_ptr<T> cmp, atomic_ptr<T> xchg) {
+		bool cas(const local_ptr<T> & cmp, atomic_ptr<T> & xchg) {
+			atomic_ptr<T> temp(xchg);
+			return cas(cmp, std::move(temp));
+		}
+
+		//-----------------------------------------------------------------
+		// cas -- compare and swap w/o temps.  On success xchg holds the
+		// previous value, on failure xchg is unchanged and may be reused
+		// for a retry.
+		//-----------------------------------------------------------------
+		bool cas(const local_ptr<T> & cmp, atomic_ptr<T> && xchg) {
 			differentialReference<T> temp;
 			bool rc = false;
 
-			temp.ecount = ref.ecount;
-			temp.ptr = cmp.refptr;
+			temp.set(cmp.refptr, ref.getCount());
 
 			do {
 				if (atomic_compare_exchange_strong_explicit(&ref, &temp, xchg.ref, memory_order_acq_rel, memory_order_relaxed)) {
@@ -426,7 +1024,7 @@ template<typename T> class atomic_ptr {
 				}
 
 			}
-			while (cmp.refptr == temp.ptr);
+			while (cmp.refptr == temp.getPtr());
 
 			return rc;
 		}
@@ -455,12 +1053,30 @@ template<typename T> class atomic_ptr {
 			obj.ref.ecount = temp.ecount;
 			obj.ref.ptr = temp.ptr;
 			*/
-			obj.ref = atomic_exchange_explicit(&ref, obj.ref, memory_order_release, memory_order_relaxed);
+			obj.ref = atomic_exchange_explicit(&ref, obj.ref, memory_order_release);
 		}
 
 	private:
 
 		// atomic
+#if ATOMIC_PTR_PACKED
+		atomic_ptr_ref<T> * getrefptr() {
+			differentialReference<T> oldval;
+
+			// ephemeral count wraps off the top of the word
+			oldval.word = atomic_fetch_add_explicit(&ref.word, ECOUNT_ONE, MEMBAR0);
+			return oldval.getPtr();
+		}
+
+		// current ref w/o acquiring a reference.  Only valid for
+		// comparison against refs the caller already holds.
+		atomic_ptr_ref<T> * peekrefptr() {
+			differentialReference<T> temp;
+
+			temp.word = atomic_load_explicit(&ref.word, MEMBAR0);
+			return temp.getPtr();
+		}
+#else
 		atomic_ptr_ref<T> * getrefptr() {
 			differentialReference<T> oldval, newval;
 
@@ -476,6 +1092,13 @@ template<typename T> class atomic_ptr {
 			return atomic_load_explicit(&oldval.ptr, MEMBAR0);
 		}
 
+		// current ref w/o acquiring a reference.  Only valid for
+		// comparison against refs the caller already holds.
+		atomic_ptr_ref<T> * peekrefptr() {
+			return atomic_load_explicit(&ref.ptr, MEMBAR0);
+		}
+#endif
+
 }; // class atomic_ptr
 
 template<typename T> inline bool operator == (int lhd, atomic_ptr<T> & rhd)
@@ -490,6 +1113,192 @@ template<typename T> inline bool operator == (T * lhd, atomic_ptr<T> & rhd)
 template<typename T> inline bool operator != (T * lhd, atomic_ptr<T> & rhd)
 	{ return (rhd != lhd); }
 
+
+//=============================================================================
+// atomic_ptr_session -- scoped read session
+//
+// Holds up to N distinct refs inline, more spill to a heap table that
+// doubles as needed, e.g. if a writer keeps republishing during a long
+// session.  If an atomic_ptr's current ref is already
+// held by the session it is returned w/o any interlocked update.  Otherwise
+// an ephemeral reference is acquired and kept until the session ends.
+// Repeated acquires of the same ref are accumulated and dropped with a
+// single drop(n).
+//
+// Pointers returned by get are valid until release or the end of the
+// session.  get returns nullptr if the table can't grow, with no
+// reference held.  Like local_ptr, a session is local to a thread.
+//=============================================================================
+template<typename T, int N> class atomic_ptr_session {
+	public:
+
+		atomic_ptr_session() {
+			refs = inlineRefs;
+			counts = inlineCounts;
+			size = N;
+			nrefs = 0;
+		}
+
+		~atomic_ptr_session() {
+			release();
+			if (refs != inlineRefs) {
+				free(refs);
+				free(counts);
+			}
+		}
+
+		T * get(atomic_ptr<T> & src) {
+			atomic_ptr_ref<T> * refptr;
+			int j;
+
+			if ((refptr = src.peekrefptr()) == nullptr)
+				return nullptr;
+
+			// current ref already held
+			for (j = 0; j < nrefs && refs[j] != refptr; j++) {}
+			if (j < nrefs)
+				return atomic_load_explicit(&refptr->ptr, MEMBAR1);
+
+			if ((refptr = src.getrefptr()) == nullptr)
+				return nullptr;		// ephemeral count on null link is harmless
+
+			for (j = 0; j < nrefs && refs[j] != refptr; j++) {}
+			if (j < nrefs)
+				counts[j]++;		// deferred decrement
+			else if (nrefs < size || grow()) {
+				refs[nrefs] = refptr;
+				counts[nrefs] = 1;
+				nrefs++;
+			}
+			else {
+				if (refptr->drop(1) == 0)		// table full, hold nothing
+					refptr->dispose();
+				return nullptr;
+			}
+
+			return atomic_load_explicit(&refptr->ptr, MEMBAR1);
+		}
+
+		//-----------------------------------------------------------------
+		// release -- drop all references held by the session
+		//-----------------------------------------------------------------
+		void release() {
+			for (int j = 0; j < nrefs; j++) {
+				if (refs[j]->drop(counts[j]) == 0)
+					refs[j]->dispose();
+			}
+			nrefs = 0;
+		}
+
+	private:
+		void * operator new (size_t);		// auto only
+
+		atomic_ptr_session(const atomic_ptr_session &);
+		atomic_ptr_session & operator = (const atomic_ptr_session &);
+
+		//-----------------------------------------------------------------
+		// grow -- double the table, spilling to the heap, false if no memory
+		//-----------------------------------------------------------------
+		bool grow() {
+			atomic_ptr_ref<T> **	xrefs;
+			long *					xcounts;
+
+			xrefs = (atomic_ptr_ref<T> **)malloc(2 * size * sizeof(atomic_ptr_ref<T> *));
+			xcounts = (long *)malloc(2 * size * sizeof(long));
+			if (xrefs == nullptr || xcounts == nullptr) {
+				free(xrefs);
+				free(xcounts);
+				return false;
+			}
+
+			memcpy(xrefs, refs, nrefs * sizeof(atomic_ptr_ref<T> *));
+			memcpy(xcounts, counts, nrefs * sizeof(long));
+			if (refs != inlineRefs) {
+				free(refs);
+				free(counts);
+			}
+			refs = xrefs;
+			counts = xcounts;
+			size *= 2;
+			return true;
+		}
+
+		atomic_ptr_ref<T> *	inlineRefs[N];
+		long				inlineCounts[N];
+		atomic_ptr_ref<T> **	refs;		// held refs
+		long *				counts;			// ephemeral references per ref
+		int					size;
+		int					nrefs;
+
+}; // class atomic_ptr_session
+
+
+#ifdef ATOMIC_PTR_SMR
+//=============================================================================
+// atomic_ptr_hazard -- hazard pointer protected read of an atomic_ptr
+//
+// Holds one fastsmr hazard pointer pair for its lifetime.  get() publishes
+// the atomic_ptr's current ref in the hazard pointer and reloads the link
+// until it is unchanged, after which the object can't be reclaimed until
+// the guard is reset, reused or destroyed.  No reference counts are
+// touched.  The memory barrier between the store and the reload is
+// supplied by the fastsmr RCU pass that precedes the hazard pointer scan.
+//=============================================================================
+template<typename T> class atomic_ptr_hazard {
+	public:
+
+		atomic_ptr_hazard() {
+			if ((hptr = smr_acquire()) == NULL)
+				abort();
+			refptr = nullptr;
+		}
+
+		atomic_ptr_hazard(atomic_ptr<T> & src) : atomic_ptr_hazard() {
+			get(src);
+		}
+
+		~atomic_ptr_hazard() {
+			smr_dealloc(hptr);
+		}
+
+		T * get(atomic_ptr<T> & src) {
+			atomic_ptr_ref<T> * temp;
+
+			refptr = src.peekrefptr();
+			do {
+				temp = refptr;
+				atomic_store_explicit(hptr, (smr_t)temp, memory_order_relaxed);
+				refptr = src.peekrefptr();
+			}
+			while (refptr != temp);
+
+			return (refptr != nullptr) ? atomic_load_explicit(&refptr->ptr, MEMBAR1) : nullptr;
+		}
+
+		void reset() {
+			atomic_store_explicit(hptr, (smr_t)NULL, memory_order_release);
+			refptr = nullptr;
+		}
+
+		T * get() { return (refptr != nullptr) ? refptr->ptr : nullptr; }
+		T * operator -> () { return get(); }
+		T & operator * () { return *get(); }
+
+		bool operator == (T * rhd) { return (get() == rhd); }
+		bool operator != (T * rhd) { return (get() != rhd); }
+
+	private:
+		void * operator new (size_t);		// auto only
+
+		atomic_ptr_hazard(const atomic_ptr_hazard &);
+		atomic_ptr_hazard & operator = (const atomic_ptr_hazard &);
+
+		smr_t *				hptr;			// hazard pointer pair
+		atomic_ptr_ref<T> *	refptr;			// protected ref
+
+}; // class atomic_ptr_hazard
+#endif
+
 #endif // _ATOMIC_PTR_H
 
 
@@ -0,0 +1,444 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// bench.h -- reclamation scheme benchmark driver
+//
+//   Each scheme has its own driver (bench_atomic_ptr.cpp, bench_stpc.cpp,
+// bench_rcpc.cpp, bench_fastsmr.cpp), which defines a scheme class and
+// calls bench::run<scheme>(argc, argv).  Threads share one list whose head
+// is protected by the scheme.  An op is either a read, which protects the
+// head and walks the list, or a write, which publishes a new head node
+// and retires the old one.  The list tail is immutable, so each write
+// retires exactly one node.
+//
+// workloads (-w), each a default read ratio and list length:
+//   snapshot    read-mostly pointer snapshot, 99% reads, length 1
+//   list        list traversal, 90% reads, length 64
+//   retire      retire storm, all writes, length 1
+//
+// options:
+//   -t threads  comma separated list, one run per count (default 1,2,4)
+//   -r percent  reads per 100 ops
+//   -s bytes    node payload size (default 64)
+//   -l length   list length
+//   -d seconds  run time per thread count (default 1)
+//   -x variant  scheme specific variant
+//
+//   Each run prints ops/sec, p50/p99/p999 op latency and the peak bytes
+// and nodes retired but not yet reclaimed.  Latency is per op from a
+// log-linear histogram (1/32 resolution) and includes the clock read and,
+// for writes, the node allocation.
+// Pending memory is sampled every millisecond.
+//
+// build, e.g.
+//   c++ -std=gnu++17 -O2 -mcx16 -Iatomic-ptr bench/bench_atomic_ptr.cpp -latomic -lpthread
+//   cc -std=gnu11 -O2 -c stpc/stpc.c
+//   c++ -std=gnu++17 -O2 -Istpc -Ilfds bench/bench_stpc.cpp stpc.o -latomic -lpthread
+//   cc -std=gnu11 -O2 -c rcpc/rcpc.c
+//   c++ -std=gnu++17 -O2 -Ircpc -Ilfds bench/bench_rcpc.cpp rcpc.o -latomic -lpthread
+//   c++ -std=gnu++17 -O2 -Ifastsmr bench/bench_fastsmr.cpp <fastsmr objects> -lqcount -lpthread
+//
+//------------------------------------------------------------------------------
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+//-----------------------------------------------------------------------------
+// now -- monotonic time in nanoseconds
+//-----------------------------------------------------------------------------
+inline uint64_t now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+//=============================================================================
+// histogram -- log-linear latency histogram, ns
+//
+//   values below 2*SUB are exact, above that each power of 2 is split
+// into SUB buckets.
+//=============================================================================
+class histogram {
+	public:
+		enum { SUB = 32, SHIFT = 5, BUCKETS = 60 * SUB };
+
+		histogram() { memset(count, 0, sizeof(count)); }
+
+		void add(uint64_t v) { count[index(v)]++; }
+
+		void merge(const histogram & src) {
+			for (int ndx = 0; ndx < BUCKETS; ndx++)
+				count[ndx] += src.count[ndx];
+		}
+
+		uint64_t total() const {
+			uint64_t n = 0;
+			for (int ndx = 0; ndx < BUCKETS; ndx++)
+				n += count[ndx];
+			return n;
+		}
+
+		// value at quantile q (0..1), bucket lower bound
+		uint64_t quantile(double q) const {
+			uint64_t	n = total();
+			uint64_t	rank = (uint64_t)(q * n);
+			uint64_t	seen = 0;
+
+			for (int ndx = 0; ndx < BUCKETS; ndx++) {
+				if ((seen += count[ndx]) > rank)
+					return value(ndx);
+			}
+			return 0;
+		}
+
+	private:
+		static int index(uint64_t v) {
+			int msb;
+
+			if (v < 2 * SUB)
+				return (int)v;
+			msb = 63 - __builtin_clzll(v);
+			if (msb - SHIFT >= BUCKETS / SUB - 1)
+				return BUCKETS - 1;
+			return (msb - SHIFT) * SUB + (int)(v >> (msb - SHIFT));
+		}
+
+		static uint64_t value(int ndx) {
+			if (ndx < 2 * SUB)
+				return ndx;
+			return (uint64_t)(ndx % SUB + SUB) << (ndx / SUB - 1);
+		}
+
+		uint64_t	count[BUCKETS];
+
+}; // class histogram
+
+
+//=============================================================================
+// pending -- bytes and nodes retired but not yet reclaimed
+//
+//   counted per benchmark thread, reclaiming threads outside the benchmark
+// share one slot.  slots are kept for all runs since nodes may be retired
+// on one and reclaimed on another, and summed by the sampler.
+//=============================================================================
+struct alignas(128) counters {
+	std::atomic<long>	retiredBytes;
+	std::atomic<long>	retiredNodes;
+	std::atomic<long>	freedBytes;
+	std::atomic<long>	freedNodes;
+};
+
+inline counters					other;
+inline thread_local counters *	local = &other;
+inline std::vector<counters *>	slots;
+inline volatile long			sink;		// keeps walk
+
+inline void count(std::atomic<long> & c, long v) {
+	c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+
+//=============================================================================
+// node -- list node, payload follows the node
+//=============================================================================
+struct node {
+	node *		next;
+	size_t		size;		// payload bytes
+	bool		retired;	// head node, counted as pending once replaced
+	void *		link;		// scheme use, e.g. its retire record
+
+	static node * make(size_t size, node * next) {
+		node * n = new (size) node;
+		n->next = next;
+		n->size = size;
+		n->retired = true;
+		n->link = NULL;
+		memset(n->payload(), (int)(uintptr_t)n, size);
+		count(local->retiredBytes, sizeof(node) + size);
+		count(local->retiredNodes, 1);
+		return n;
+	}
+
+	unsigned char * payload() { return (unsigned char *)(this + 1); }
+
+	~node() {
+		counters * c = local;
+
+		if (!retired)
+			return;
+		if (c == &other) {
+			other.freedBytes.fetch_add(sizeof(node) + size, std::memory_order_relaxed);
+			other.freedNodes.fetch_add(1, std::memory_order_relaxed);
+		}
+		else {
+			count(c->freedBytes, sizeof(node) + size);
+			count(c->freedNodes, 1);
+		}
+	}
+
+	static void * operator new (size_t n, size_t extra) {
+		void * p;
+		if ((p = malloc(n + extra)) == NULL)
+			abort();
+		return p;
+	}
+
+	static void operator delete (void * p) { free(p); }
+};
+
+
+//-----------------------------------------------------------------------------
+// walk -- touch every node on the list, e.g. under the scheme's protection
+//-----------------------------------------------------------------------------
+inline long walk(node * n) {
+	long	sum = 0;
+
+	for (; n != NULL; n = n->next) {
+		if (n->size > 0)
+			sum += n->payload()[0] + n->payload()[n->size - 1];
+		else
+			sum++;
+	}
+	return sum;
+}
+
+
+//=============================================================================
+// options
+//=============================================================================
+struct options {
+	const char *		workload;
+	std::vector<int>	threads;
+	int					reads;			// percent
+	size_t				size;
+	int					length;
+	double				seconds;
+	const char *		variant;
+};
+
+inline void usage(const char * name) {
+	fprintf(stderr, "usage: %s [-w snapshot|list|retire] [-t n,n,..] [-r reads%%] [-s size] [-l length] [-d seconds] [-x variant]\n", name);
+	exit(1);
+}
+
+inline options parse(int argc, char ** argv) {
+	options		opt;
+	int			reads = -1, length = -1;
+	int			c;
+
+	opt.workload = "snapshot";
+	opt.size = 64;
+	opt.seconds = 1.0;
+	opt.variant = "";
+
+	while ((c = getopt(argc, argv, "w:t:r:s:l:d:x:")) != -1) {
+		switch (c) {
+			case 'w':	opt.workload = optarg; break;
+			case 't':
+				for (char * p = optarg; *p != 0; p += (*p == ',')) {
+					opt.threads.push_back((int)strtol(p, &p, 10));
+					if (opt.threads.back() <= 0)
+						usage(argv[0]);
+				}
+				break;
+			case 'r':	reads = atoi(optarg); break;
+			case 's':	opt.size = (size_t)atol(optarg); break;
+			case 'l':	length = atoi(optarg); break;
+			case 'd':	opt.seconds = atof(optarg); break;
+			case 'x':	opt.variant = optarg; break;
+			default:	usage(argv[0]);
+		}
+	}
+
+	if (strcmp(opt.workload, "snapshot") == 0) {
+		opt.reads = 99;
+		opt.length = 1;
+	}
+	else if (strcmp(opt.workload, "list") == 0) {
+		opt.reads = 90;
+		opt.length = 64;
+	}
+	else if (strcmp(opt.workload, "retire") == 0) {
+		opt.reads = 0;
+		opt.length = 1;
+	}
+	else
+		usage(argv[0]);
+
+	if (reads >= 0)
+		opt.reads = reads;
+	if (length >= 1)
+		opt.length = length;
+	if (opt.threads.empty())
+		opt.threads = {1, 2, 4};
+
+	return opt;
+}
+
+
+//-----------------------------------------------------------------------------
+// run -- run the workload at each thread count
+//
+//   Scheme interface:
+//     Scheme(options &, node * head)
+//     static const char * name()
+//     void attach()             calling thread starts using the scheme
+//     void detach()             ...stops
+//     long read()               protect head, walk list
+//     void write(node * head)   publish head, retire the old one
+//     void quiesce()            reclaim or let reclaim what's retired
+//   The Scheme destructor deletes the remaining list head.
+//-----------------------------------------------------------------------------
+template<typename Scheme> int run(int argc, char ** argv) {
+	options	opt = parse(argc, argv);
+	node *	tail = NULL;
+
+	local = &other;
+	for (int ndx = 1; ndx < opt.length; ndx++) {
+		tail = node::make(opt.size, tail);
+		tail->retired = false;				// immutable tail, never retired
+	}
+	other.retiredBytes = 0;
+	other.retiredNodes = 0;
+
+	printf("%-12s %-10s %-8s %7s %5s %6s %5s %12s %8s %8s %8s %12s %9s\n",
+		"scheme", "variant", "workload", "threads", "reads", "size", "len",
+		"ops/s", "p50", "p99", "p999", "peak_bytes", "peak_objs");
+
+	for (int nthreads : opt.threads) {
+		Scheme			scheme(opt, node::make(opt.size, tail));
+		std::vector<std::thread>	threads;
+		std::vector<histogram *>	latency(nthreads);
+		std::atomic<int>	ready(0);
+		std::atomic<bool>	go(false), stop(false);
+		long			peakBytes = 0, peakNodes = 0;
+		size_t			first;
+		uint64_t		start, end;
+		histogram		total;
+
+		for (int ndx = 0; ndx < nthreads; ndx++)
+			latency[ndx] = new histogram;
+		first = slots.size();
+		for (int ndx = 0; ndx < nthreads; ndx++)
+			slots.push_back(new counters());
+
+		for (int ndx = 0; ndx < nthreads; ndx++) {
+			threads.emplace_back([&, ndx]() {
+				histogram *	h = latency[ndx];
+				uint64_t	seed = 0x9e3779b97f4a7c15ULL * (ndx + 1);
+				uint64_t	t0, t1;
+				long		sum = 0;
+
+				local = slots[first + ndx];
+				scheme.attach();
+				ready++;
+				while (!go.load(std::memory_order_acquire))
+					sched_yield();
+
+				t0 = now();
+				while (!stop.load(std::memory_order_relaxed)) {
+					seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;	// xorshift
+					if ((int)(seed % 100) < opt.reads)
+						sum += scheme.read();
+					else
+						scheme.write(node::make(opt.size, tail));
+					t1 = now();
+					h->add(t1 - t0);
+					t0 = t1;
+				}
+
+				scheme.quiesce();
+				scheme.detach();
+				local = &other;
+				sink = sum;
+			});
+		}
+
+		while (ready.load() < nthreads)
+			usleep(100);
+
+		start = now();
+		go.store(true, std::memory_order_release);
+		end = start + (uint64_t)(opt.seconds * 1e9);
+		while (now() < end) {
+			long bytes = -(long)(sizeof(node) + opt.size);	// less current head
+			long nodes = -1;
+
+			bytes += other.retiredBytes.load(std::memory_order_relaxed) - other.freedBytes.load(std::memory_order_relaxed);
+			nodes += other.retiredNodes.load(std::memory_order_relaxed) - other.freedNodes.load(std::memory_order_relaxed);
+			for (size_t ndx = 0; ndx < slots.size(); ndx++) {
+				counters * c = slots[ndx];
+				bytes += c->retiredBytes.load(std::memory_order_relaxed) - c->freedBytes.load(std::memory_order_relaxed);
+				nodes += c->retiredNodes.load(std::memory_order_relaxed) - c->freedNodes.load(std::memory_order_relaxed);
+			}
+			if (bytes > peakBytes)
+				peakBytes = bytes;
+			if (nodes > peakNodes)
+				peakNodes = nodes;
+			usleep(1000);
+		}
+		stop = true;
+		for (std::thread & t : threads)
+			t.join();
+		end = now();
+
+		for (int ndx = 0; ndx < nthreads; ndx++) {
+			total.merge(*latency[ndx]);
+			delete latency[ndx];
+		}
+
+		printf("%-12s %-10s %-8s %7d %5d %6zu %5d %12.0f %8llu %8llu %8llu %12ld %9ld\n",
+			Scheme::name(), opt.variant, opt.workload, nthreads, opt.reads, opt.size, opt.length,
+			total.total() / ((end - start) / 1e9),
+			(unsigned long long)total.quantile(0.50),
+			(unsigned long long)total.quantile(0.99),
+			(unsigned long long)total.quantile(0.999),
+			peakBytes, peakNodes);
+		fflush(stdout);
+	}
+
+	while (tail != NULL) {
+		node * next = tail->next;
+		delete tail;
+		tail = next;
+	}
+	for (counters * c : slots)
+		delete c;
+	slots.clear();
+	return 0;
+}
+
+} // namespace bench
+
+#endif /* BENCH_H */
+
+
+/*-*/
@@ -0,0 +1,80 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// bench_atomic_ptr.cpp -- atomic_ptr benchmark driver, see bench.h
+//
+// variants (-x):
+//   (none)      local_ptr per read
+//   session     atomic_ptr_session held across SESSION reads
+//
+//------------------------------------------------------------------------------
+
+#include <atomic_ptr.h>
+#include "bench.h"
+
+using bench::node;
+
+#define SESSION 16				// reads per session
+
+class scheme {
+	public:
+		scheme(bench::options & opt, node * first) : head(first) {
+			session = (strcmp(opt.variant, "session") == 0);
+		}
+
+		static const char * name() { return "atomic_ptr"; }
+
+		void attach() {}
+		void detach() {}
+
+		long read() {
+			if (session) {
+				long sum = bench::walk(reader.get(head));
+				if (++reads % SESSION == 0)
+					reader.release();
+				return sum;
+			}
+
+			local_ptr<node> p(head);
+			return bench::walk(p.get());
+		}
+
+		void write(node * n) {
+			head = n;				// old node deleted w/ last reference
+		}
+
+		void quiesce() {
+			reader.release();
+		}
+
+	private:
+		atomic_ptr<node>	head;
+		bool				session;
+
+		static thread_local atomic_ptr_session<node, SESSION>	reader;
+		static thread_local int		reads;
+};
+
+thread_local atomic_ptr_session<node, SESSION>	scheme::reader;
+thread_local int	scheme::reads = 0;
+
+int main(int argc, char ** argv) {
+	return bench::run<scheme>(argc, argv);
+}
+
+
+/*-*/
@@ -0,0 +1,142 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// bench_fastsmr.cpp -- fastsmr benchmark driver, see bench.h
+//
+//   Readers publish the head in a hazard pointer, writers smr_defer the
+// old head.  Threads announce a quiesce point every QUIESCE ops.
+// fastsmr is started once for all runs, each run waits for its deferred
+// work to drain before the next.
+//
+// variants (-x):
+//   (none)      qcount quiesce point detection
+//   membarrier  membarrier backend
+//   epoch       epoch backend
+//
+//------------------------------------------------------------------------------
+
+#include <pthread.h>
+#include <fastsmr.h>
+#include <rcustats.h>
+#include "bench.h"
+
+using bench::node;
+
+#define QUIESCE 16					// ops per quiesce point
+
+class scheme {
+	public:
+		scheme(bench::options & opt, node * first) : head(first) {
+			if (!started) {
+				rcu_setMembarrier(strcmp(opt.variant, "membarrier") == 0);
+				rcu_setEpoch(strcmp(opt.variant, "epoch") == 0);
+				rcu_startup();
+				started = true;
+			}
+		}
+
+		~scheme() {
+			rcu_stats_t	stats;
+
+			delete head.load();
+			for (int j = 0; j < 100; j++) {
+				copyStats(&stats);
+				if (stats.deferred_work == 0)
+					break;
+				rcu_synchronize_expedited();
+			}
+		}
+
+		static const char * name() { return "fastsmr"; }
+
+		void attach() {
+			if ((hptr = smr_acquire()) == NULL)
+				abort();
+		}
+
+		void detach() {
+			smr_dealloc(hptr);
+		}
+
+		long read() {
+			node *	n;
+			long	sum;
+
+			do {
+				n = head.load(std::memory_order_relaxed);
+				__atomic_store_n(&hptr[0], (void *)n, __ATOMIC_RELAXED);
+				std::atomic_signal_fence(std::memory_order_seq_cst);
+			}
+			while (head.load(std::memory_order_relaxed) != n);
+
+			sum = bench::walk(n);
+
+			std::atomic_signal_fence(std::memory_order_seq_cst);
+			__atomic_store_n(&hptr[0], (void *)NULL, __ATOMIC_RELAXED);
+			tick();
+			return sum;
+		}
+
+		void write(node * n) {
+			node *			old = head.exchange(n, std::memory_order_acq_rel);
+			rcu_defer_t *	defer = new rcu_defer_t();
+
+			old->link = defer;
+			defer->func = &reclaim;
+			defer->arg = old;				// hazard pointer value
+			defer->forrefs = &forrefs;
+			defer->type = trace;
+			smr_defer_sized(defer, sizeof(node) + old->size);
+			tick();
+		}
+
+		void quiesce() {
+			rcu_quiesce();
+		}
+
+	private:
+		static void reclaim(void * arg) {
+			node * n = (node *)arg;
+
+			delete (rcu_defer_t *)n->link;
+			delete n;
+		}
+
+		static void forrefs(void *, int (*)(rcu_defer_t *)) {}	// no refs to trace
+
+		void tick() {
+			if (++ops % QUIESCE == 0)
+				rcu_quiesce();
+		}
+
+		std::atomic<node *>	head;
+
+		static bool		started;
+		static thread_local smr_t *	hptr;
+		static thread_local int		ops;
+};
+
+bool	scheme::started = false;
+thread_local smr_t *	scheme::hptr = NULL;
+thread_local int		scheme::ops = 0;
+
+int main(int argc, char ** argv) {
+	return bench::run<scheme>(argc, argv);
+}
+
+
+/*-*/
@@ -0,0 +1,258 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// bench_lfds.cpp -- lfds container benchmark driver
+//
+//   Runs a lfds container (lfds/queue.hpp, stack.hpp, hash_map.hpp) under
+// the reclamation policy selected at compile time, RECLAIM_STPC (default),
+// RECLAIM_RCPC or RECLAIM_FASTSMR.  Prints ops/sec and p50/p99/p999 op
+// latency (bench::histogram) per thread count.
+//
+// containers (-c):
+//   queue       op is a push and a pop
+//   stack       op is a push and a pop
+//   map         op is a find, or an insert or erase of a random key,
+//               half the keys are inserted up front
+//
+// options:
+//   -t threads  comma separated list, one run per count (default 1,2,4)
+//   -r percent  map finds per 100 ops (default 90)
+//   -k keys     map key range (default 1024)
+//   -d seconds  run time per thread count (default 1)
+//   -x variant  fastsmr backend, membarrier or epoch (default qcount)
+//
+//   Threads call the policy's quiesce every QUIESCE ops.
+//
+// build, e.g.
+//   c++ -std=gnu++17 -O2 -Ilfds -Istpc bench/bench_lfds.cpp stpc.o -latomic -lpthread
+//   c++ -std=gnu++17 -O2 -Ilfds -Ircpc -DRECLAIM_RCPC bench/bench_lfds.cpp rcpc.o -latomic -lpthread
+//   c++ -std=gnu++17 -O2 -Ilfds -Ifastsmr -DRECLAIM_FASTSMR bench/bench_lfds.cpp <fastsmr objects> -lqcount -lpthread
+//
+//------------------------------------------------------------------------------
+
+#if defined(RECLAIM_FASTSMR)
+#include <smr_reclaim.hpp>
+typedef lfds::smr_reclaim policy;
+#define RECLAIM_NAME "fastsmr"
+
+#elif defined(RECLAIM_RCPC)
+#include <rcpc.hpp>
+#include <reclaim.hpp>
+typedef lfds::proxy_reclaim<rcpc::proxy, rcpc::guard> policy;
+#define RECLAIM_NAME "rcpc"
+
+#else
+#include <stpc.hpp>
+#include <reclaim.hpp>
+typedef lfds::proxy_reclaim<stpc::proxy, stpc::guard> policy;
+#define RECLAIM_NAME "stpc"
+#endif
+
+#include <queue.hpp>
+#include <stack.hpp>
+#include <hash_map.hpp>
+#include "bench.h"
+
+#define QUIESCE 16					// ops per quiesce point
+
+struct config {
+	const char *		container;
+	std::vector<int>	threads;
+	int					reads;		// percent
+	long				keys;
+	double				seconds;
+	const char *		variant;
+};
+
+static void usage(const char * name) {
+	fprintf(stderr, "usage: %s [-c queue|stack|map] [-t n,n,..] [-r reads%%] [-k keys] [-d seconds] [-x variant]\n", name);
+	exit(1);
+}
+
+//-----------------------------------------------------------------------------
+// op -- one benchmark op on container C, seed is the thread's xorshift
+//-----------------------------------------------------------------------------
+template<typename C> struct op;
+
+template<typename T> struct op<lfds::queue<T, policy>> {
+	static void prefill(lfds::queue<T, policy> &, config &) {}
+
+	static long run(lfds::queue<T, policy> & c, config &, uint64_t seed) {
+		long	value;
+
+		c.push((long)seed);
+		return c.pop(value) ? value : 0;
+	}
+};
+
+template<typename T> struct op<lfds::stack<T, policy>> {
+	static void prefill(lfds::stack<T, policy> &, config &) {}
+
+	static long run(lfds::stack<T, policy> & c, config &, uint64_t seed) {
+		long	value;
+
+		c.push((long)seed);
+		return c.pop(value) ? value : 0;
+	}
+};
+
+template<typename K, typename V> struct op<lfds::hash_map<K, V, policy>> {
+	static void prefill(lfds::hash_map<K, V, policy> & c, config & cfg) {
+		for (long key = 0; key < cfg.keys; key += 2)
+			c.insert(key, key);
+	}
+
+	static long run(lfds::hash_map<K, V, policy> & c, config & cfg, uint64_t seed) {
+		long	key = (long)((seed >> 8) % cfg.keys);
+		long	value = 0;
+
+		if ((int)(seed % 100) < cfg.reads)
+			return c.find(key, value) ? value : 0;
+		else if (seed & (1 << 7))
+			return c.insert(key, key);
+		else
+			return c.erase(key);
+	}
+};
+
+//-----------------------------------------------------------------------------
+// run -- run container C at each thread count
+//-----------------------------------------------------------------------------
+template<typename C> void run(config & cfg) {
+	for (int nthreads : cfg.threads) {
+		C							c;
+		std::vector<std::thread>	threads;
+		std::vector<bench::histogram *>	latency(nthreads);
+		std::atomic<int>			ready(0);
+		std::atomic<bool>			go(false), stop(false);
+		uint64_t					start, end;
+		bench::histogram			total;
+
+		op<C>::prefill(c, cfg);
+		for (int ndx = 0; ndx < nthreads; ndx++)
+			latency[ndx] = new bench::histogram;
+
+		for (int ndx = 0; ndx < nthreads; ndx++) {
+			threads.emplace_back([&, ndx]() {
+				bench::histogram *	h = latency[ndx];
+				uint64_t	seed = 0x9e3779b97f4a7c15ULL * (ndx + 1);
+				uint64_t	t0, t1;
+				long		sum = 0;
+				long		ops = 0;
+
+				ready++;
+				while (!go.load(std::memory_order_acquire))
+					sched_yield();
+
+				t0 = bench::now();
+				while (!stop.load(std::memory_order_relaxed)) {
+					seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;	// xorshift
+					sum += op<C>::run(c, cfg, seed);
+					if (++ops % QUIESCE == 0)
+						c.reclaimer().quiesce();
+					t1 = bench::now();
+					h->add(t1 - t0);
+					t0 = t1;
+				}
+
+				c.reclaimer().quiesce();
+				bench::sink = sum;
+			});
+		}
+
+		while (ready.load() < nthreads)
+			usleep(100);
+
+		start = bench::now();
+		go.store(true, std::memory_order_release);
+		usleep((useconds_t)(cfg.seconds * 1e6));
+		stop = true;
+		for (std::thread & t : threads)
+			t.join();
+		end = bench::now();
+
+		for (int ndx = 0; ndx < nthreads; ndx++) {
+			total.merge(*latency[ndx]);
+			delete latency[ndx];
+		}
+
+		printf("%-9s %-8s %7d %5d %6ld %12.0f %8llu %8llu %8llu\n",
+			cfg.container, RECLAIM_NAME, nthreads, cfg.reads, cfg.keys,
+			total.total() / ((end - start) / 1e9),
+			(unsigned long long)total.quantile(0.50),
+			(unsigned long long)total.quantile(0.99),
+			(unsigned long long)total.quantile(0.999));
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char ** argv) {
+	config	cfg;
+	int		c;
+
+	cfg.container = "queue";
+	cfg.reads = 90;
+	cfg.keys = 1024;
+	cfg.seconds = 1.0;
+	cfg.variant = "";
+
+	while ((c = getopt(argc, argv, "c:t:r:k:d:x:")) != -1) {
+		switch (c) {
+			case 'c':	cfg.container = optarg; break;
+			case 't':
+				for (char * p = optarg; *p != 0; p += (*p == ',')) {
+					cfg.threads.push_back((int)strtol(p, &p, 10));
+					if (cfg.threads.back() <= 0)
+						usage(argv[0]);
+				}
+				break;
+			case 'r':	cfg.reads = atoi(optarg); break;
+			case 'k':	cfg.keys = atol(optarg); break;
+			case 'd':	cfg.seconds = atof(optarg); break;
+			case 'x':	cfg.variant = optarg; break;
+			default:	usage(argv[0]);
+		}
+	}
+	if (cfg.threads.empty())
+		cfg.threads = {1, 2, 4};
+	if (cfg.keys <= 0)
+		usage(argv[0]);
+
+#if defined(RECLAIM_FASTSMR)
+	rcu_setMembarrier(strcmp(cfg.variant, "membarrier") == 0);
+	rcu_setEpoch(strcmp(cfg.variant, "epoch") == 0);
+	rcu_startup();
+#endif
+
+	printf("%-9s %-8s %7s %5s %6s %12s %8s %8s %8s\n",
+		"container", "reclaim", "threads", "reads", "keys",
+		"ops/s", "p50", "p99", "p999");
+
+	if (strcmp(cfg.container, "queue") == 0)
+		run<lfds::queue<long, policy>>(cfg);
+	else if (strcmp(cfg.container, "stack") == 0)
+		run<lfds::stack<long, policy>>(cfg);
+	else if (strcmp(cfg.container, "map") == 0)
+		run<lfds::hash_map<long, long, policy>>(cfg);
+	else
+		usage(argv[0]);
+
+	return 0;
+}
+
+
+/*-*/
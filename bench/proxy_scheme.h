@@ -0,0 +1,102 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// proxy_scheme.h -- stpc/rcpc benchmark scheme, see bench.h
+//
+//   Included after stpc.hpp or rcpc.hpp with namespace pc aliased to the
+// algorithm and PROXY_NAME defined.
+//
+// variants (-x):
+//   (none)      retire per write
+//   batched     retire_batched, flushed when the thread finishes
+//   cell        head in a lfds::rcu_cell, read through a snapshot
+//
+//------------------------------------------------------------------------------
+
+#ifndef PROXY_SCHEME_H
+#define PROXY_SCHEME_H
+
+#include <reclaim.hpp>
+#include <rcu_cell.hpp>
+#include "bench.h"
+
+using bench::node;
+
+class scheme {
+	public:
+		scheme(bench::options & opt, node * first) : head(first) {
+			batched = (strcmp(opt.variant, "batched") == 0);
+			if ((celled = (strcmp(opt.variant, "cell") == 0)))
+				cell.update(head.exchange(NULL));
+		}
+
+		~scheme() {
+			delete head.load();
+		}
+
+		static const char * name() { return PROXY_NAME; }
+
+		void attach() {}
+		void detach() {}
+
+		long read() {
+			if (celled) {
+				cell_t::snapshot s(cell);
+				return bench::walk((node *)s.get());
+			}
+
+			pc::guard g(px);
+			return bench::walk(head.load(std::memory_order_acquire));
+		}
+
+		void write(node * n) {
+			if (celled) {
+				cell.update(n);
+				return;
+			}
+
+			node * old = head.exchange(n, std::memory_order_acq_rel);
+
+			if (batched)
+				px.retire_batched(old);
+			else
+				px.retire(old);
+		}
+
+		void quiesce() {
+			if (batched)
+				px.flush();
+		}
+
+	private:
+		typedef lfds::rcu_cell<node, lfds::proxy_reclaim<pc::proxy, pc::guard>> cell_t;
+
+		pc::proxy			px;
+		std::atomic<node *>	head;
+		bool				batched;
+		cell_t				cell;
+		bool				celled;
+};
+
+int main(int argc, char ** argv) {
+	return bench::run<scheme>(argc, argv);
+}
+
+#endif /* PROXY_SCHEME_H */
+
+
+/*-*/
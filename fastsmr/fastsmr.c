@@ -34,6 +34,8 @@ warranty.
 #include <rcustats.h>
 #include <fastsmr.h>
 #include <atomix.h>
+#include <membarrier.h>
+#include <smrtrace.h>
 
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
@@ -41,11 +43,15 @@ pthread_mutex_t rcu_poll_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 pthread_mutex_t rcu_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t	rcu_cvar = PTHREAD_COND_INITIALIZER;
+pthread_cond_t	rcu_sync_cvar = PTHREAD_COND_INITIALIZER;	// synchronize completions
 
 rcu_stats_t	stats;					// rcu statistics
 
 fifo_t		ready_queue = FIFO_INITIALIZER;	// ready work
 utime_t		rcu_minWait = 50000;	// minimum time to wait	(usec)
+utime_t		rcu_minPoll = 10;		// adaptive polling floor (usec)
+utime_t		rcu_pollWait = 10;		// current polling interval (usec)
+int			rcu_highWork = 1024;	// backlog polled at floor
 
 
 //=============================================================
@@ -57,6 +63,63 @@ int			deferred_work = 0;
 qcount_t	qcobj;					// qcount object
 
 int			rcu_stop = 0;			// shutdown flag 0|1
+int			rcu_qwaiting = 0;		// polling thread waiting for quiesce points
+int			rcu_idle = 0;			// polling thread waiting for work
+int			rcu_membarrier = 0;		// membarrier backend, quiesce by asymmetric barrier
+int			rcu_epoch = 0;			// epoch backend, quiesce by published epochs
+int			rcu_expedite = 0;		// expedited grace periods requested
+
+
+//=============================================================
+// reclaimer threads
+//
+//	with rcu_nreclaimers > 0 the polling thread only detects grace
+//	periods.  ready work is split into batches dealt round robin onto
+//	the reclaimers' queues and the callbacks run on the reclaimers,
+//	which steal batches from each other when their own queue is empty.
+//	queues are protected by rcu_mutex, taken once per batch.
+//=============================================================
+
+typedef struct rcu_batch_tt {
+	struct rcu_batch_tt	*next;
+	rcu_defer_t	*work;				// work, linked by next
+	int			count;
+} rcu_batch_t;
+
+typedef struct {
+	pthread_t	id;
+	rcu_batch_t	*head;				// batch queue
+	rcu_batch_t	*tail;
+} rcu_reclaimer_t;
+
+#define RCU_BATCH 256				// work per batch
+
+int			rcu_nreclaimers = 0;	// reclaimer threads, 0 polling thread runs work
+rcu_reclaimer_t	*rcu_reclaimers = NULL;
+pthread_cond_t	rcu_reclaim_cvar = PTHREAD_COND_INITIALIZER;
+int			rcu_reclaim_stop = 0;	// reclaimer shutdown flag 0|1
+int			rcu_reclaim_next = 0;	// next reclaimer to deal a batch to
+
+
+//=============================================================
+// watermarks
+//
+//	above a high watermark deferring threads help reclaim until
+//	below the low watermark, or RCU_THROTTLE_TRIES passes.  the
+//	helper is at a quiesce point, rcu_mutex is a full barrier, and
+//	its own rcu node is treated as quiesced while it scans.
+//=============================================================
+
+#define RCU_THROTTLE_TRIES 8
+
+int			rcu_highMark = 0;		// deferred work count, 0 unbounded
+int			rcu_lowMark = 0;
+size_t		rcu_highBytes = 0;		// deferred bytes, 0 unbounded
+size_t		rcu_lowBytes = 0;
+size_t		rcu_deferred_bytes = 0;	// bytes held by deferred work (atomic)
+
+__thread int rcu_reclaiming = 0;	// polling or reclaimer thread, never throttled
+static __thread unsigned int rcu_lastPending = 0;	// thread's defer list backlog at last smr_defer
 
 
 //=============================================================
@@ -64,6 +127,7 @@ int			rcu_stop = 0;			// shutdown flag 0|1
 
 
 void *rcu_poll(void *z);			// forward declare
+void *rcu_reclaim(void *z);			// forward declare
 
 
 //------------------------------------------------------------------------------
@@ -89,10 +153,29 @@ pthread_t rcu_startpoll() {
 //
 //------------------------------------------------------------------------------
 pthread_t rcu_startup() {
+	int		j;
 
 	qcount_init(&qcobj);
 	smr_startup();
 	memset(&stats, 0, sizeof(stats));
+
+	// timed waits on the monotonic clock, see getutime
+	pthread_cond_initx(&rcu_cvar);
+	pthread_cond_initx(&rcu_sync_cvar);
+	pthread_cond_initx(&rcu_reclaim_cvar);
+
+	// fall back to qcount if membarrier not available
+	if (rcu_membarrier && !smr_membarrier_register())
+		rcu_membarrier = 0;
+
+	if (rcu_nreclaimers > 0) {
+		if ((rcu_reclaimers = (rcu_reclaimer_t *)calloc(rcu_nreclaimers, sizeof(rcu_reclaimer_t))) == NULL)
+			abort();
+		rcu_reclaim_stop = 0;
+		for (j = 0; j < rcu_nreclaimers; j++)
+			pthread_create(&(rcu_reclaimers[j].id), NULL, &rcu_reclaim, &rcu_reclaimers[j]);
+	}
+
 	return rcu_startpoll();
 }
 
@@ -102,6 +185,7 @@ pthread_t rcu_startup() {
 //
 //------------------------------------------------------------------------------
 void rcu_shutdown() {
+	int		j;
 
 	if (smr_check() != 0) {
 		abort();
@@ -114,6 +198,20 @@ void rcu_shutdown() {
 
 	pthread_join(rcu_poll_id, NULL);
 
+	// reclaimers have run all work, polling thread waited for it
+	if (rcu_reclaimers != NULL) {
+		pthread_mutex_lockx(&rcu_mutex);
+		rcu_reclaim_stop = 1;
+		pthread_cond_broadcast(&rcu_reclaim_cvar);
+		pthread_mutex_unlockx(&rcu_mutex);
+
+		for (j = 0; j < rcu_nreclaimers; j++)
+			pthread_join(rcu_reclaimers[j].id, NULL);
+
+		free(rcu_reclaimers);
+		rcu_reclaimers = NULL;
+	}
+
 	// deallocate RCU nodes if necessary
 	rcu_shutdown2();
 
@@ -124,6 +222,133 @@ void rcu_shutdown() {
 }
 
 
+//-----------------------------------------------------------------------------
+// rcu_dispatch -- deal ready work to reclaimers in batches
+//
+//	rcu_mutex held.
+//-----------------------------------------------------------------------------
+void rcu_dispatch() {
+	rcu_defer_t	*workqueue;
+	rcu_defer_t	*work;
+	rcu_batch_t	*batch;
+	rcu_reclaimer_t	*reclaimer;
+	int			n;
+
+	workqueue = fifo_dequeueall(&ready_queue);
+
+	while (workqueue != NULL) {
+		if ((batch = (rcu_batch_t *)malloc(sizeof(rcu_batch_t))) == NULL)
+			abort();
+
+		// cut batch off front of work queue
+		batch->work = workqueue;
+		for (n = 1, work = workqueue; n < RCU_BATCH && work->next != NULL; n++)
+			work = work->next;
+		workqueue = work->next;
+		work->next = NULL;
+		batch->count = n;
+
+		reclaimer = &rcu_reclaimers[rcu_reclaim_next];
+		rcu_reclaim_next = (rcu_reclaim_next + 1) % rcu_nreclaimers;
+
+		batch->next = NULL;
+		if (reclaimer->tail != NULL)
+			reclaimer->tail->next = batch;
+		else
+			reclaimer->head = batch;
+		reclaimer->tail = batch;
+
+		stats.batches++;
+	}
+
+	pthread_cond_broadcast(&rcu_reclaim_cvar);
+}
+
+
+//-----------------------------------------------------------------------------
+// rcu_take -- dequeue batch from reclaimer's queue, else steal one
+//
+//	rcu_mutex held.
+//-----------------------------------------------------------------------------
+static rcu_batch_t *rcu_take(rcu_reclaimer_t *self) {
+	rcu_reclaimer_t	*reclaimer;
+	rcu_batch_t	*batch;
+	int			j;
+
+	for (j = 0; j < rcu_nreclaimers; j++) {
+		reclaimer = &rcu_reclaimers[((self - rcu_reclaimers) + j) % rcu_nreclaimers];
+		if ((batch = reclaimer->head) != NULL) {
+			if ((reclaimer->head = batch->next) == NULL)
+				reclaimer->tail = NULL;
+			if (reclaimer != self)
+				stats.steals++;
+			return batch;
+		}
+	}
+
+	return NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// rcu_reclaim -- reclaimer thread, runs batches of ready work
+//-----------------------------------------------------------------------------
+void *rcu_reclaim(void *z) {
+	rcu_reclaimer_t	*self = (rcu_reclaimer_t *)z;
+	rcu_batch_t	*batch;
+	rcu_defer_t	*work;
+	rcu_defer_t	*workqueue;
+	size_t		workbytes;
+	rcu_hist_t	freetime;			// defer to free, merged per batch
+	ntime_t		now;
+
+	rcu_reclaiming = 1;
+	pthread_mutex_lockx(&rcu_mutex);
+
+	for (;;) {
+
+		if ((batch = rcu_take(self)) != NULL) {
+
+			pthread_mutex_unlockx(&rcu_mutex);
+
+			workqueue = batch->work;
+			workbytes = 0;
+			memset(&freetime, 0, sizeof(freetime));
+			now = getntime();
+			while ((work = workqueue) != NULL) {
+				workbytes += work->size;
+				if (work->deferred != 0)
+					rcu_hist_add(&freetime, now - work->deferred);
+				workqueue = work->next;		// dequeue
+				work->func(work->arg);
+			}
+
+			if (workbytes != 0)
+				__atomic_sub_fetch(&rcu_deferred_bytes, workbytes, __ATOMIC_RELAXED);
+			SMR_TRACE2(batch, batch->count, workbytes);
+
+			pthread_mutex_lockx(&rcu_mutex);
+			rcu_hist_merge(&stats.freetime, &freetime);
+			stats.undefers += batch->count;
+			deferred_work -= batch->count;
+			if (deferred_work == 0)
+				pthread_cond_broadcast(&rcu_cvar);		// polling thread may be waiting on it
+			free(batch);
+		}
+
+		else if (rcu_reclaim_stop != 0)
+			break;
+
+		else
+			pthread_cond_wait(&rcu_reclaim_cvar, &rcu_mutex);
+	}
+
+	pthread_mutex_unlockx(&rcu_mutex);
+
+	return NULL;
+}
+
+
 //-----------------------------------------------------------------------------
 // process_work --
 //-----------------------------------------------------------------------------
@@ -131,19 +356,38 @@ void process_work() {
 	rcu_defer_t	*work;
 	rcu_defer_t	*workqueue;
 	int			workcount;			// count of work performed
+	size_t		workbytes;			// bytes of work performed
+	rcu_hist_t	freetime;			// defer to free, merged per pass
+	ntime_t		now;
+
+	if (rcu_nreclaimers > 0) {
+		rcu_dispatch();
+		return;
+	}
 
 	while ((workqueue = fifo_dequeueall(&ready_queue)) != NULL) {
 
 		pthread_mutex_unlockx(&rcu_mutex);
 
 		workcount = 0;
+		workbytes = 0;
+		memset(&freetime, 0, sizeof(freetime));
+		now = getntime();
 		while ((work = workqueue) != NULL) {
 			workcount++;
+			workbytes += work->size;
+			if (work->deferred != 0)
+				rcu_hist_add(&freetime, now - work->deferred);
 			workqueue = work->next;		// dequeue
 			work->func(work->arg);
 		}
 
+		if (workbytes != 0)
+			__atomic_sub_fetch(&rcu_deferred_bytes, workbytes, __ATOMIC_RELAXED);
+		SMR_TRACE2(work, workcount, workbytes);
+
 		pthread_mutex_lockx(&rcu_mutex);
+		rcu_hist_merge(&stats.freetime, &freetime);
 		stats.undefers += workcount;
 		deferred_work -= workcount;
 	}
@@ -156,6 +400,11 @@ void process_work() {
 // rcu_xxxx --
 //-----------------------------------------------------------------------------
 int rcu_xxxx() {
+	ntime_t	start = getntime();
+
+	// steal threads' deferred work
+	//
+	smr_collect();
 
 	// poll threads for quiesce points
 	//
@@ -166,6 +415,8 @@ int rcu_xxxx() {
 	//
 	smr_scan();
 
+	rcu_hist_add(&stats.scantime, getntime() - start);
+
 	// process ready deferred work
 	//
 	if (ready_queue.tail != NULL) {
@@ -186,30 +437,47 @@ int rcu_xxxx() {
 //
 //-----------------------------------------------------------------------------
 void *rcu_poll(void *z) {
-	utime_t	now, next;
+	utime_t	now, next, wait;
 	struct	timespec	nexttime;
 
 
+	rcu_reclaiming = 1;
 	pthread_mutex_lockx(&rcu_mutex);
 
 	for (;;) {
 
 		if (rcu_xxxx())
-			;
+			rcu_pollWait = rcu_minPoll;		// work done, poll soon
 
 		else if (deferred_work > 0) {
 			//
 			// no quiesce point, wait a while
 			//
+			// polling interval backs off from rcu_minPoll to
+			// rcu_minWait while no work completes, and stays at
+			// rcu_minPoll when expedited or backlogged.  Quiesce
+			// point announcements and backlog wake it early.
+			//
+
+			if (rcu_expedite > 0 || deferred_work >= rcu_highWork)
+				wait = rcu_minPoll;
+			else {
+				wait = rcu_pollWait;
+				if ((rcu_pollWait *= 2) > rcu_minWait)
+					rcu_pollWait = rcu_minWait;
+			}
 
-			now = getutimeofday();
-			next = now + rcu_minWait;
+			now = getutime();
+			next = now + wait;
 			nexttime.tv_sec = utime_sec(next);
 			nexttime.tv_nsec = utime_nsec(next);
-			pthread_cond_timedwait(&rcu_cvar, &rcu_mutex, &nexttime);
+			rcu_qwaiting = 1;
+			if (pthread_cond_timedwait(&rcu_cvar, &rcu_mutex, &nexttime) == 0)
+				stats.qwakeups++;
+			rcu_qwaiting = 0;
 
 			stats.qwaits++;
-			stats.qtime += (getutimeofday() - now);
+			stats.qtime += (getutime() - now);
 
 		} // if  (deferred_work > 0)
 
@@ -220,12 +488,20 @@ void *rcu_poll(void *z) {
 		//
 		// wait for work
 		//
+		// rcu_idle is set before rechecking the defer lists, so a
+		// mutex free smr_defer either is collected or sees rcu_idle
+		// and signals.
+		//
 		else {
-			now = getutimeofday();
-			pthread_cond_wait(&rcu_cvar, &rcu_mutex);
-
-			stats.wwaits++;
-			stats.wtime += (getutimeofday() - now);
+			__atomic_store_n(&rcu_idle, 1, __ATOMIC_SEQ_CST);
+			if (smr_collect() == 0) {
+				now = getutime();
+				pthread_cond_wait(&rcu_cvar, &rcu_mutex);
+
+				stats.wwaits++;
+				stats.wtime += (getutime() - now);
+			}
+			__atomic_store_n(&rcu_idle, 0, __ATOMIC_RELAXED);
 		}
 
 
@@ -244,13 +520,112 @@ printf("polling thread returning...\n");
 }
 
 
+//------------------------------------------------------------------------------
+// rcu_overHigh -- deferred work above a high watermark
+//
+//	pending is the calling thread's uncollected work.  racy reads,
+//	the watermarks are soft.
+//------------------------------------------------------------------------------
+static inline int rcu_overHigh(unsigned int pending) {
+	if (rcu_reclaiming)
+		return 0;
+	if (rcu_highMark > 0 && deferred_work + (int)pending >= rcu_highMark)
+		return 1;
+	if (rcu_highBytes > 0 && __atomic_load_n(&rcu_deferred_bytes, __ATOMIC_RELAXED) >= rcu_highBytes)
+		return 1;
+	return 0;
+}
+
+static inline int rcu_overLow() {
+	if (rcu_highMark > 0 && deferred_work > rcu_lowMark)
+		return 1;
+	if (rcu_highBytes > 0 && __atomic_load_n(&rcu_deferred_bytes, __ATOMIC_RELAXED) > rcu_lowBytes)
+		return 1;
+	return 0;
+}
+
+
+//------------------------------------------------------------------------------
+// rcu_throttle -- help reclaim until below low watermark
+//
+//	runs rcu_xxxx inline with an expedited grace period in effect,
+//	blocking rcu_minPoll after passes that made no progress.
+//------------------------------------------------------------------------------
+void rcu_throttle() {
+	utime_t	now, next;
+	struct	timespec	nexttime;
+	uint32_t	*self;
+	int		progress;
+	int		qpoints;
+	int		j;
+
+	rcu_reclaiming = 1;					// no nested throttle from deferred work
+	self = smr_self();
+	pthread_mutex_lockx(&rcu_mutex);
+	rcu_expedite++;
+	stats.throttles++;
+	now = getutime();
+
+	for (j = 0; j < RCU_THROTTLE_TRIES; j++) {
+		qpoints = stats.qpoints;
+		rcu_self = self;
+		progress = rcu_xxxx();
+		rcu_self = NULL;
+		if (!rcu_overLow())
+			break;
+
+		if (progress || stats.qpoints != qpoints)
+			continue;				// grace period advancing, no wait
+
+		next = getutime() + rcu_minPoll;
+		nexttime.tv_sec = utime_sec(next);
+		nexttime.tv_nsec = utime_nsec(next);
+		pthread_cond_timedwait(&rcu_cvar, &rcu_mutex, &nexttime);
+	}
+
+	stats.ttime += (getutime() - now);
+	rcu_expedite--;
+	pthread_mutex_unlockx(&rcu_mutex);
+	rcu_reclaiming = 0;
+}
+
+
 //------------------------------------------------------------------------------
 // smr_defer -- 
 //
+//	threads with an smr node push onto their own defer list without the
+//	rcu_mutex.  the mutex is only taken to wake the polling thread.
+//	other threads enqueue directly.
 //------------------------------------------------------------------------------
-int smr_defer(rcu_defer_t *work) {
+static int rcu_defer(rcu_defer_t *work, size_t bytes) {
+	unsigned int	pending;
+	unsigned int	high = (unsigned int)rcu_highWork;	// >= 1, see setter
+	int			crossed;
 	int			n;
 
+	work->size = bytes;
+	work->deferred = getntime();
+	if (bytes != 0)
+		__atomic_add_fetch(&rcu_deferred_bytes, bytes, __ATOMIC_RELAXED);
+
+	if ((pending = smr_push(work)) != 0) {
+		SMR_TRACE2(defer, work, pending);
+		crossed = (rcu_lastPending < high && pending >= high);	// backlog reached high since last defer
+		rcu_lastPending = pending;
+		if (__atomic_load_n(&rcu_idle, __ATOMIC_SEQ_CST)
+			|| (crossed && rcu_qwaiting))
+		{
+			pthread_mutex_lockx(&rcu_mutex);
+			stats.defersigs++;
+			pthread_cond_signal(&rcu_cvar);
+			pthread_mutex_unlockx(&rcu_mutex);
+		}
+
+		if (rcu_overHigh(pending))
+			rcu_throttle();
+		return 0;
+	}
+
 	pthread_mutex_lockx(&rcu_mutex);
 	stats.defers++;
 
@@ -258,18 +633,127 @@ int smr_defer(rcu_defer_t *work) {
 
 	rcu_enqueue(work, pass1);
 
+	SMR_TRACE2(defer, work, deferred_work + 1);
 	if ((n = deferred_work++) == 0)
 		stats.defersigs++;
 
+	else if (n + 1 == rcu_highWork && rcu_qwaiting)
+		n = 0;			// backlogged, poll now
 
 	pthread_mutex_unlockx(&rcu_mutex);
 
 	if (n == 0)			 // polling thread waiting for work
 		pthread_cond_signal(&rcu_cvar);
 
+	if (rcu_overHigh(0))
+		rcu_throttle();
+
 	return 0;
 }
 
+int smr_defer(rcu_defer_t *work) {
+	return rcu_defer(work, 0);
+}
+
+
+//------------------------------------------------------------------------------
+// smr_defer_sized -- defer work holding bytes, for byte watermarks
+//------------------------------------------------------------------------------
+int smr_defer_sized(rcu_defer_t *work, size_t bytes) {
+	return rcu_defer(work, bytes);
+}
+
+
+//------------------------------------------------------------------------------
+// rcu_synchronize_expedited -- wait for a grace period
+//
+//	A marker is deferred like any other work and the polling thread
+//	polls at rcu_minPoll until it has passed through rcu and smr.
+//	Not callable from the polling thread or deferred work.
+//------------------------------------------------------------------------------
+typedef struct {
+	rcu_defer_t	defer;
+	int			done;
+} rcu_sync_t;
+
+static void rcu_sync_done(void *arg) {
+	rcu_sync_t	*sync = (rcu_sync_t *)arg;
+
+	pthread_mutex_lockx(&rcu_mutex);
+	sync->done = 1;
+	pthread_cond_broadcast(&rcu_sync_cvar);
+	pthread_mutex_unlockx(&rcu_mutex);
+}
+
+void rcu_synchronize_expedited() {
+	rcu_sync_t	sync;
+	uint32_t	*self;
+	int			online;
+
+	// an epoch thread waiting here would hold up its own grace period
+	self = rcu_epoch ? smr_self() : NULL;
+	if ((online = (self != NULL && __atomic_load_n(self, __ATOMIC_RELAXED) != 0)))
+		rcu_offline();
+
+	memset(&sync, 0, sizeof(sync));
+	sync.defer.func = &rcu_sync_done;
+	sync.defer.arg = &sync;				// never in a hazard pointer
+	sync.defer.type = trace;
+	sync.defer.deferred = getntime();
+
+	pthread_mutex_lockx(&rcu_mutex);
+	rcu_expedite++;
+	stats.expedites++;
+	stats.defers++;
+
+	sync.defer.sequence = current - 1;
+	rcu_enqueue(&sync.defer, pass1);
+	deferred_work++;
+
+	pthread_cond_signal(&rcu_cvar);
+	while (!sync.done)
+		pthread_cond_wait(&rcu_sync_cvar, &rcu_mutex);
+
+	rcu_expedite--;
+	pthread_mutex_unlockx(&rcu_mutex);
+
+	if (online)
+		rcu_online();
+}
+
+
+//------------------------------------------------------------------------------
+// rcu_quiesce -- announce quiesce point
+//
+//	publishes the current epoch with the epoch backend.  wakes the
+//	polling thread if it is waiting for quiesce points so the announcing
+//	thread's qcount or epoch change is seen without waiting out the
+//	polling interval.
+//------------------------------------------------------------------------------
+void rcu_quiesce() {
+	if (rcu_epoch)
+		smr_qepoch(__atomic_load_n(&rcu_gp_epoch, __ATOMIC_RELAXED));
+	if (rcu_qwaiting)
+		pthread_cond_signal(&rcu_cvar);
+}
+
+
+//------------------------------------------------------------------------------
+// rcu_offline/rcu_online -- extended quiesce point, epoch backend
+//
+//	an offline thread holds no hazard pointers and does not hold up
+//	grace periods, e.g. while blocked in a system call.
+//------------------------------------------------------------------------------
+void rcu_offline() {
+	if (rcu_epoch)
+		smr_qepoch(0);
+}
+
+void rcu_online() {
+	if (rcu_epoch)
+		smr_qepoch(__atomic_load_n(&rcu_gp_epoch, __ATOMIC_RELAXED));
+}
+
 
 //------------------------------------------------------------------------------
 // rcu_check --
@@ -302,6 +786,87 @@ int rcu_getMinWait() {
 }
 
 
+//------------------------------------------------------------------------------
+// (set|get)Membarrier -- membarrier backend, set before rcu_startup
+//
+//	get returns 1 only if in effect
+//------------------------------------------------------------------------------
+void rcu_setMembarrier(int val) {
+	rcu_membarrier = (val != 0);
+}
+
+int rcu_getMembarrier() {
+	return rcu_membarrier;
+}
+
+
+//------------------------------------------------------------------------------
+// (set|get)Epoch -- epoch backend, set before rcu_startup
+//
+//	threads must call rcu_quiesce periodically, membarrier takes
+//	precedence if both are in effect.
+//------------------------------------------------------------------------------
+void rcu_setEpoch(int val) {
+	rcu_epoch = (val != 0);
+}
+
+int rcu_getEpoch() {
+	return rcu_epoch;
+}
+
+
+//------------------------------------------------------------------------------
+// (set|get)Reclaimers -- callback threads, set before rcu_startup
+//------------------------------------------------------------------------------
+void rcu_setReclaimers(int val) {
+	if (rcu_reclaimers == NULL)
+		rcu_nreclaimers = (val > 0) ? val : 0;
+}
+
+int rcu_getReclaimers() {
+	return rcu_nreclaimers;
+}
+
+
+//------------------------------------------------------------------------------
+// setWatermarks -- deferred work count watermarks, high 0 unbounded
+//------------------------------------------------------------------------------
+void rcu_setWatermarks(int high, int low) {
+	rcu_lowMark = (low < high) ? low : high / 2;
+	rcu_highMark = (high > 0) ? high : 0;
+}
+
+
+//------------------------------------------------------------------------------
+// setByteWatermarks -- smr_defer_sized byte watermarks, high 0 unbounded
+//------------------------------------------------------------------------------
+void rcu_setByteWatermarks(size_t high, size_t low) {
+	rcu_lowBytes = (low < high) ? low : high / 2;
+	rcu_highBytes = high;
+}
+
+
+//------------------------------------------------------------------------------
+// (set|get)MinPoll in microseconds
+//------------------------------------------------------------------------------
+void rcu_setMinPoll(int val) {
+	rcu_minPoll = (val > 0) ? val : 1;
+	rcu_pollWait = rcu_minPoll;
+}
+
+int rcu_getMinPoll() {
+	return (int)rcu_minPoll;
+}
+
+
+//------------------------------------------------------------------------------
+// setHighWork -- deferred work backlog polled at rcu_minPoll
+//------------------------------------------------------------------------------
+void rcu_setHighWork(int val) {
+	rcu_highWork = (val > 0) ? val : 1;
+}
+
+
 //------------------------------------------------------------------------------
 // copyStats --
 //------------------------------------------------------------------------------
@@ -309,6 +874,7 @@ void copyStats(rcu_stats_t * target) {
 	pthread_mutex_lockx(&rcu_mutex);
 	memcpy(target, &stats, sizeof(stats));
 	target->deferred_work = deferred_work;
+	target->deferred_bytes = __atomic_load_n(&rcu_deferred_bytes, __ATOMIC_RELAXED);
 	pthread_mutex_unlockx(&rcu_mutex);
 }
 
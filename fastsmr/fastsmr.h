@@ -61,6 +61,8 @@ typedef struct rcu_defer_tt {
 	//
 	sequence_t	sequence;			// trace sequence number
 	sequence_t	*psequence;			// fifo sequence number
+	size_t		size;				// bytes held, smr_defer_sized
+	ntime_t		deferred;			// defer time, for defer to free latency
 
 	//--
 
@@ -84,9 +86,26 @@ extern smr_t * smr_alloc();				// allocate hazard pointer
 extern void smr_dealloc(smr_t *);		// deallocate hazard pointer
 
 extern int smr_defer(rcu_defer_t *);	// defer work 
+extern int smr_defer_sized(rcu_defer_t *, size_t);	// defer work holding bytes
 
 extern void rcu_setMinWait(int);		// set polling interval (msecs)
 extern int rcu_getMinWait();			// get polling interval (msecs)
+extern void rcu_setMinPoll(int);		// set adaptive polling floor (usecs)
+extern int rcu_getMinPoll();			// get adaptive polling floor (usecs)
+extern void rcu_setHighWork(int);		// set deferred work backlog polled at floor
+extern void rcu_setWatermarks(int, int);		// set deferred work high/low watermarks
+extern void rcu_setByteWatermarks(size_t, size_t);	// set deferred bytes high/low watermarks
+extern void rcu_setMembarrier(int);		// set membarrier backend, before rcu_startup
+extern int rcu_getMembarrier();			// membarrier backend in effect
+extern void rcu_setEpoch(int);			// set epoch backend, before rcu_startup
+extern int rcu_getEpoch();				// epoch backend in effect
+extern void rcu_setReclaimers(int);		// set callback threads, before rcu_startup
+extern int rcu_getReclaimers();			// get callback threads
+
+extern void rcu_synchronize_expedited();	// wait for grace period, polling at floor
+extern void rcu_quiesce();				// announce quiesce point, wake polling thread
+extern void rcu_offline();				// enter extended quiesce point (epoch backend)
+extern void rcu_online();				// leave extended quiesce point (epoch backend)
 
 #ifdef __cplusplus
 }
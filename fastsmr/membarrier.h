@@ -0,0 +1,84 @@
+/*
+Copyright 2005, 2006 Joseph W. Seigh 
+
+Permission to use, copy, modify and distribute this software
+and its documentation for any purpose and without fee is
+hereby granted, provided that the above copyright notice
+appear in all copies, that both the copyright notice and this
+permission notice appear in supporting documentation.  I make
+no representations about the suitability of this software for
+any purpose. It is provided "as is" without express or implied
+warranty.
+
+---
+*/
+
+//------------------------------------------------------------------------------
+// membarrier.h -- asymmetric memory barrier (Linux sys_membarrier)
+//
+// version -- 0.0.1 (pre-alpha)
+//
+// smr_membarrier forces a full memory barrier on every running thread of
+// the process, so readers' plain hazard pointer stores are visible to the
+// scan that follows.  Stands in for quiesce point detection.
+//
+//------------------------------------------------------------------------------
+
+
+#ifndef SMR_MEMBARRIER_H
+#define SMR_MEMBARRIER_H
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__linux__) && defined(__NR_membarrier)
+#define SMR_HAVE_MEMBARRIER 1
+#else
+#define SMR_HAVE_MEMBARRIER 0
+#endif
+
+//-----------------------------------------------------------------------------
+// smr_membarrier_register -- register process for expedited membarrier
+//
+//   returns 1 if available
+//-----------------------------------------------------------------------------
+static inline int smr_membarrier_register() {
+#if SMR_HAVE_MEMBARRIER
+	long	cmds;
+
+	cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+	if (cmds < 0 || (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) == 0)
+		return 0;
+
+	return (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0);
+#else
+	return 0;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// smr_membarrier -- full memory barrier on all running threads
+//-----------------------------------------------------------------------------
+static inline void smr_membarrier() {
+#if SMR_HAVE_MEMBARRIER
+	if (syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) != 0)
+		abort();
+#else
+	abort();
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SMR_MEMBARRIER_H */
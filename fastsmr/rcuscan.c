@@ -35,6 +35,7 @@ warranty.
 #include <rcustats.h>
 #include <fastsmr.h>
 #include <atomix.h>
+#include <membarrier.h>
 
 
 //-----------------------------------------------------------------------------
@@ -48,6 +49,7 @@ typedef struct rcu_node_tt {
 
 	uint32_t	last_qcount;	// qcount  at last checkpoint
 	qhandle_t	qhandle;		// qcount query handle
+	uint32_t	*qepoch;		// published quiesce epoch (smr node)
 
 	//
 	// deferred work FIFO queues
@@ -76,6 +78,31 @@ qcount_t	qcobj;					// qcount object
 
 rcu_node_t	*current_node = NULL;
 
+uint32_t	*rcu_self = NULL;		// scanning thread's epoch slot, at a quiesce point
+uint32_t	rcu_gp_epoch = 1;		// grace period epoch, 0 reserved for offline
+
+int			rcu_nnodes = 0;			// rcu nodes on the ring
+int			rcu_gp_quiesced = 0;	// nodes quiesced since rcu_gp_start
+ntime_t		rcu_gp_start = 0;		// grace period start, 0 none timed
+
+
+//-----------------------------------------------------------------------------
+// rcu_qget -- node's quiesce count, its published epoch or qcount
+//
+//	an offline thread (epoch 0) is reported as not running.
+//-----------------------------------------------------------------------------
+static uint32_t rcu_qget(rcu_node_t *node, int *runstate) {
+	uint32_t	epoch;
+
+	if (rcu_epoch) {
+		epoch = __atomic_load_n(node->qepoch, __ATOMIC_ACQUIRE);
+		*runstate = (epoch != 0);
+		return epoch;
+	}
+
+	return qcount_get(qcobj, node->qhandle, runstate);
+}
+
 
 //-----------------------------------------------------------------------------
 // rcu_requeue -- transfer work to smr or ready queue
@@ -126,8 +153,9 @@ void rcu_enqueue(rcu_defer_t *work, rcu_defer_state_t state) {
 //------------------------------------------------------------------------------
 // rcu_add_node --
 //
+//	qepoch is the smr node's epoch slot, and identifies the rcu node.
 //------------------------------------------------------------------------------
-void rcu_add_node(qhandle_t qhandle) {
+void rcu_add_node(qhandle_t qhandle, uint32_t *qepoch) {
 	rcu_node_t *node;
 	int		runstate;
 
@@ -138,9 +166,11 @@ void rcu_add_node(qhandle_t qhandle) {
 	memset(node, 0, sizeof(rcu_node_t));
 
 	node->qhandle = qhandle;
+	node->qepoch = qepoch;
 
 	// set initial quiesce count and runstate
-	node->last_qcount = qcount_get(qcobj, node->qhandle, &runstate);
+	node->last_qcount = rcu_qget(node, &runstate);
+	rcu_nnodes++;
 
 	fifo_init(&(node->queue0));
 	fifo_init(&(node->queue1));
@@ -174,23 +204,23 @@ void rcu_add_node(qhandle_t qhandle) {
 //------------------------------------------------------------------------------
 // rcu_delete_node --
 //------------------------------------------------------------------------------
-void rcu_delete_node(qhandle_t qhandle) {
+void rcu_delete_node(uint32_t *qepoch) {
 	rcu_node_t	*node;
 	
 	if (current_node == NULL)
 		return;
 	//
-	// lookup node by qhandle 
+	// lookup node by epoch slot
 	//
 	node = current_node;
 	do {
-		if (node->qhandle == qhandle)	// pthread_equal?
+		if (node->qepoch == qepoch)
 			break;
 		node = node->next;
 	}
 	while (node != current_node);
 
-	if (node->qhandle != qhandle) {
+	if (node->qepoch != qepoch) {
 		return;
 	}
 		
@@ -228,6 +258,7 @@ void rcu_delete_node(qhandle_t qhandle) {
 	if (node->queue1.tail != NULL)
 		abort();
 
+	rcu_nnodes--;
 	free(node);
 
 
@@ -247,30 +278,61 @@ void rcu_scan() {
 	//
 	// poll threads/processors for quiesce points
 	//
+	// membarrier backend: one asymmetric barrier quiesces every thread,
+	// and orders all hazard pointer stores before the smr_scan that
+	// follows, so it is issued even with no rcu nodes.
+	//
+	// epoch backend: advance the epoch, threads publish it at quiesce
+	// points and a node is quiesced once its published epoch changes.
+	//
 
-	qcount_set(qcobj);
+	if (rcu_membarrier)
+		smr_membarrier();
+	else if (rcu_epoch) {
+		__atomic_store_n(&rcu_gp_epoch, (rcu_gp_epoch + 1) ? (rcu_gp_epoch + 1) : 1, __ATOMIC_SEQ_CST);
+	}
+	else
+		qcount_set(qcobj);
+
+	//
+	// grace period timing, from the first scan with work waiting until
+	// every node has been seen quiesced once
+	//
+
+	if (deferred_work == 0)
+		rcu_gp_start = 0;
+	else if (rcu_gp_start == 0) {
+		rcu_gp_start = getntime();
+		rcu_gp_quiesced = 0;
+	}
 
 	if((node = current_node) == NULL)
 		return;
 
 	do {
 
-		now = getutimeofday();
+		now = getutime();
 
 		//----------------------------------------------------------------------
 		// check for quiesce point
 		//----------------------------------------------------------------------
 
-		qcount = qcount_get(qcobj, node->qhandle, &runstate);
+		// thread/processor fenced by membarrier
+		if (rcu_membarrier) {
+			qcount = node->last_qcount;
+			node->state = state_explicit;
+			stats.qexplicit++;
+		}
 
 		// thread/processor not running
-		if (!runstate) {
+		else if (qcount = rcu_qget(node, &runstate), !runstate) {
 			node->state = state_norun;
 			stats.norun++;
 		}
 
-		// thread/processor quiesced
-		else if (qcount != node->last_qcount) {
+		// thread/processor quiesced, or scanning thread itself
+		else if (qcount != node->last_qcount
+			|| (rcu_self != NULL && node->qepoch == rcu_self)) {
 			node->state  = state_explicit;
 			stats.qexplicit++;
 		}
@@ -291,6 +353,14 @@ void rcu_scan() {
 		node->last_time = now;			// time quiesce point was seen
 		stats.qpoints++;				// count of quiesce points overall
 
+		if (rcu_gp_start != 0 && ++rcu_gp_quiesced >= rcu_nnodes) {
+			ntime_t gp_end = getntime();
+
+			rcu_hist_add(&stats.gptime, gp_end - rcu_gp_start);
+			rcu_gp_start = gp_end;
+			rcu_gp_quiesced = 0;
+		}
+
 		//
 		// shift work on deferred work queues
 		//
@@ -315,7 +385,7 @@ void rcu_scan() {
 void rcu_shutdown2() {
 	pthread_mutex_lockx(&rcu_mutex);
 	while (current_node != NULL) {
-		rcu_delete_node(current_node->qhandle);
+		rcu_delete_node(current_node->qepoch);
 	}
 	pthread_mutex_unlockx(&rcu_mutex);
 }
@@ -31,6 +31,74 @@ extern "C" {
 
 #include <utime.h>
 
+//-----------------------------------------------------------------------------
+// latency histogram, nanoseconds
+//
+//   exact below 2*RCU_HIST_SUB, above that RCU_HIST_SUB buckets per power
+// of 2.  the last bucket holds everything from about 9 minutes up.
+//-----------------------------------------------------------------------------
+#define RCU_HIST_SHIFT 2
+#define RCU_HIST_SUB (1 << RCU_HIST_SHIFT)
+#define RCU_HIST_BUCKETS (40 * RCU_HIST_SUB)
+
+typedef struct {
+	unsigned long long	count[RCU_HIST_BUCKETS];
+	unsigned long long	samples;
+	ntime_t	total;		// sum of samples
+	ntime_t	max;
+} rcu_hist_t;
+
+static inline int rcu_hist_bucket(ntime_t t) {
+	int		msb;
+
+	if (t < 2 * RCU_HIST_SUB)
+		return (int)t;
+	msb = 63 - __builtin_clzll(t);
+	if (msb - RCU_HIST_SHIFT >= RCU_HIST_BUCKETS / RCU_HIST_SUB - 1)
+		return RCU_HIST_BUCKETS - 1;
+	return (msb - RCU_HIST_SHIFT) * RCU_HIST_SUB + (int)(t >> (msb - RCU_HIST_SHIFT));
+}
+
+// bucket lower bound
+static inline ntime_t rcu_hist_value(int bucket) {
+	if (bucket < 2 * RCU_HIST_SUB)
+		return bucket;
+	return (ntime_t)(bucket % RCU_HIST_SUB + RCU_HIST_SUB) << (bucket / RCU_HIST_SUB - 1);
+}
+
+static inline void rcu_hist_add(rcu_hist_t *hist, ntime_t t) {
+	hist->count[rcu_hist_bucket(t)]++;
+	hist->samples++;
+	hist->total += t;
+	if (t > hist->max)
+		hist->max = t;
+}
+
+static inline void rcu_hist_merge(rcu_hist_t *dst, rcu_hist_t *src) {
+	int		j;
+
+	for (j = 0; j < RCU_HIST_BUCKETS; j++)
+		dst->count[j] += src->count[j];
+	dst->samples += src->samples;
+	dst->total += src->total;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+// value at quantile q (0..1), e.g. 0.99
+static inline ntime_t rcu_hist_quantile(rcu_hist_t *hist, double q) {
+	unsigned long long	rank = (unsigned long long)(q * hist->samples);
+	unsigned long long	seen = 0;
+	int		j;
+
+	for (j = 0; j < RCU_HIST_BUCKETS; j++) {
+		if ((seen += hist->count[j]) > rank)
+			return rcu_hist_value(j);
+	}
+	return 0;
+}
+
+
 //-----------------------------------------------------------------------------
 // stats
 //-----------------------------------------------------------------------------
@@ -44,6 +112,11 @@ typedef struct {
 	utime_t wtime;		// accumlated wait for work time
 	//
 	int		qwakeups;	// quiesce point wait wakeups 
+	int		expedites;	// expedited grace periods
+	int		batches;	// work batches dealt to reclaimers
+	int		steals;		// batches stolen by other reclaimers
+	int		throttles;	// deferring threads helping reclaim, above high watermark
+	utime_t	ttime;		// accumulated throttle time
 	//
 	int		defers;		// number of defers
 	int		undefers;	// number of undefers (continues)
@@ -55,8 +128,14 @@ typedef struct {
 	int		smrfull;	// smr queue fully processed
 	int		smrpartial;	// smr queue partial processed
 
+	// latency
+	rcu_hist_t	gptime;		// grace period, every rcu node quiesced once
+	rcu_hist_t	freetime;	// defer to free
+	rcu_hist_t	scantime;	// polling pass, collect and scans
+
 	// debugging info
 	int		deferred_work;	// copy of current deferred work count;
+	size_t	deferred_bytes;	// copy of current deferred bytes
 } rcu_stats_t;
 
 
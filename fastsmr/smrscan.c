@@ -27,26 +27,54 @@ warranty.
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
 
 #include <userrcu.h>
 #include <fastsmr.h>
 #include <atomix.h>
 #include <rcustats.h>
+#include <smrtrace.h>
 
 #define containerof(ptr, type, member) \
 	((type *)(((char *)ptr) - (int)&(((type *)0)->member)))
 
 
+//-----------------------------------------------------------------------------
+// hazard pointer chunk
+//
+//	hazard pointers past the node's inline ones are allocated, in pairs,
+//	from cache line chunks linked off the node.  chunks are kept until
+//	thread exit so hazard pointer addresses stay valid.
+//-----------------------------------------------------------------------------
+#ifndef SMR_CACHE_LINE
+#define SMR_CACHE_LINE 128			// nominal cache size
+#endif
+
+#define SMR_HPTRS	(SMR_CACHE_LINE / sizeof(smr_t))			// inline hazard pointers
+#define SMR_CHUNK	((SMR_CACHE_LINE / sizeof(smr_t) - 1) & ~1)	// chunk hazard pointers
+
+typedef struct smr_chunk_tt {
+	union {
+		struct {
+			smr_t	hptr[SMR_CHUNK];	// hazard pointers
+			struct smr_chunk_tt *next;
+		};
+
+		char	cache[SMR_CACHE_LINE];
+	};
+} smr_chunk_t;
+
+
 //-----------------------------------------------------------------------------
 // SMR node (thread)
 //-----------------------------------------------------------------------------
 typedef struct smr_node_tt {
 	union {
 		struct {
-			smr_t	hptr[2];		// hazard pointers
+			smr_t	hptr[SMR_HPTRS];	// hazard pointers
 		};
 
-		char	cache[128];			// nominal cache size
+		char	cache[SMR_CACHE_LINE];
 	};
 
 	//------------------------------
@@ -57,8 +85,17 @@ typedef struct smr_node_tt {
 	struct smr_node_tt *prev;
 
 	qhandle_t		qhandle;		// qcount query handle
+	uint32_t		qepoch;			// published quiesce epoch, 0 offline
 	unsigned int	ndx;			// hptr index
 	unsigned int	hcount;			// number of hazard pointers
+	smr_chunk_t		*chunks;		// hazard pointers past SMR_HPTRS
+
+	//
+	// deferred work, lifo pushed by owner, stolen by polling thread
+	//
+	rcu_defer_t		*defer_list;
+	unsigned int	defers;			// count pushed (owner)
+	unsigned int	collected;		// count stolen (polling thread)
 
 	// debugging info
 	pthread_t		tid;			// pthread id for thread
@@ -81,11 +118,61 @@ unsigned int	hsize = 0;				// size of list
 unsigned int	hcount = 0;				// count of ptr's in list
 
 
+int smr_collect_node(smr_node_t *);
+
+
+//------------------------------------------------------------------------------
+// smr_slot -- address of hazard pointer ndx
+//------------------------------------------------------------------------------
+static smr_t * smr_slot(smr_node_t *node, unsigned int ndx) {
+	smr_chunk_t	*chunk;
+
+	if (ndx < SMR_HPTRS)
+		return &(node->hptr[ndx]);
+
+	ndx -= SMR_HPTRS;
+	for (chunk = node->chunks; ndx >= SMR_CHUNK; ndx -= SMR_CHUNK)
+		chunk = chunk->next;
+	return &(chunk->hptr[ndx]);
+}
+
+
+//------------------------------------------------------------------------------
+// smr_next -- allocate next hazard pointer pair, growing by a chunk if full
+//
+//	the chunk is linked before ndx is bumped so smr_scan never sees an
+//	index past the linked chunks.
+//------------------------------------------------------------------------------
+static smr_t * smr_next(smr_node_t *node) {
+	smr_chunk_t	*chunk;
+	smr_chunk_t	**last;
+	smr_t		*hptr;
+
+	if (node->ndx >= node->hcount) {
+		if (posix_memalign((void **)&chunk, SMR_CACHE_LINE, sizeof(smr_chunk_t)) != 0)
+			return NULL;
+		memset(chunk, 0, sizeof(smr_chunk_t));
+
+		for (last = &(node->chunks); *last != NULL; last = &((*last)->next)) {}
+		__atomic_store_n(last, chunk, __ATOMIC_RELEASE);
+		node->hcount += SMR_CHUNK;
+	}
+
+	hptr = smr_slot(node, node->ndx);
+	__atomic_store_n(&(node->ndx), node->ndx + 2, __ATOMIC_RELEASE);
+
+	return hptr;
+}
+
+
 //------------------------------------------------------------------------------
 // smr_tracecb --
+//
+//	returns 0 for nodes already marked this scan, their references have
+//	been traced.
 //------------------------------------------------------------------------------
 int smr_tracecb(rcu_defer_t *defer) {
-	if (defer->state != live) {
+	if (defer->state != live && defer->sequence != current) {
 		defer->sequence = current;		// reachable
 		return 1;
 	}
@@ -95,6 +182,48 @@ int smr_tracecb(rcu_defer_t *defer) {
 }
 
 
+//------------------------------------------------------------------------------
+// hazard pointer snapshot
+//
+//	copied hazard pointers are sorted and deduplicated once per scan so
+//	each deferred work lookup is a binary search.
+//------------------------------------------------------------------------------
+static int smr_cmp(const void *a, const void *b) {
+	uintptr_t	x = (uintptr_t)*(smr_t *)a;
+	uintptr_t	y = (uintptr_t)*(smr_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static unsigned int smr_sort(smr_t *list, unsigned int count) {
+	unsigned int	j, n;
+
+	if (count < 2)
+		return count;
+
+	qsort(list, count, sizeof(smr_t), &smr_cmp);
+	for (j = 1, n = 1; j < count; j++)
+		if (list[j] != list[n - 1])
+			list[n++] = list[j];
+
+	return n;
+}
+
+static int smr_hazard(smr_t *list, unsigned int count, void *p) {
+	unsigned int	lo = 0, hi = count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((uintptr_t)list[mid] < (uintptr_t)p)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo < count && list[lo] == p);
+}
+
+
 //------------------------------------------------------------------------------
 // smr_enqueue --
 //
@@ -128,24 +257,28 @@ smr_t * smr_acquire() {
 	if ((node = (smr_node_t *)pthread_getspecific(smr_key)) == NULL) {
 
 		// initialize TSD (per thread)
-		if ((node = (smr_node_t *)malloc(sizeof(smr_node_t))) == NULL)
+		if (posix_memalign((void **)&node, SMR_CACHE_LINE, sizeof(smr_node_t)) != 0)
 			return NULL;
 
 		memset(node, 0, sizeof(smr_node_t));
 		node->ndx = 0;
-		node->hcount = 2;
-		node->hptr[0] = NULL;
-		node->hptr[1] = NULL;
+		node->hcount = SMR_HPTRS;
+		node->chunks = NULL;
 
 		// debugging info
 		node->tid = pthread_self();
 
 		pthread_mutex_lockx(&rcu_mutex);
 
-		// add RCU node if RCU thread polling in effect
-		if (qcount_self(&(node->qhandle))) {
+		// add RCU node if epoch or RCU thread polling in effect
+		if (rcu_epoch) {
+			node->qepoch = rcu_gp_epoch;
+			rcu_add_node(node->qhandle, &(node->qepoch));
+		}
+
+		else if (qcount_self(&(node->qhandle))) {
 			qcount_set(qcobj);
-			rcu_add_node(node->qhandle);
+			rcu_add_node(node->qhandle, &(node->qepoch));
 		}
 
 		if (pthread_setspecific(smr_key, (void *)node) != 0)
@@ -164,14 +297,9 @@ smr_t * smr_acquire() {
 
 	}
 
-	// return next available pair hazard pointer in array
-
-	if (node->ndx < node->hcount) {
-		hptr = &(node->hptr[node->ndx]);
-		node->ndx += 2;
-	}
+	// return next available pair hazard pointer
 
-	else
+	if ((hptr = smr_next(node)) == NULL)
 		abort();
 
 	return hptr;
@@ -187,6 +315,7 @@ void smr_release(void *tsd) {
 	smr_node_t	*node = (smr_node_t *)tsd;
 	rcu_defer_t * workqueue;
 	rcu_defer_t * work;
+	smr_chunk_t	*chunk, *next;
 
 	if (node == NULL) {
 		abort();
@@ -195,6 +324,8 @@ void smr_release(void *tsd) {
 
 	pthread_mutex_lockx(&rcu_mutex);
 
+	smr_collect_node(node);				// steal remaining deferred work
+
 	if (node->next != NULL)
 		node->next->prev = node->prev;
 
@@ -214,8 +345,12 @@ void smr_release(void *tsd) {
 		//pthread_cond_signal(&rcu_cvar);		// ??
 	}
 
-	rcu_delete_node(node->qhandle);
+	rcu_delete_node(&(node->qepoch));
 
+	for (chunk = node->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
 	free(node);
 
 	pthread_mutex_unlockx(&rcu_mutex);
@@ -225,6 +360,121 @@ void smr_release(void *tsd) {
 }
 
 
+//-----------------------------------------------------------------------------
+// smr_push -- push deferred work onto thread's defer list
+//
+//	mutex free.  returns count of work pushed and not yet collected, 0 if
+//	thread has no smr node.
+//-----------------------------------------------------------------------------
+unsigned int smr_push(rcu_defer_t *work) {
+	smr_node_t	*node;
+	rcu_defer_t	*head;
+	unsigned int	pending;
+
+	if ((node = (smr_node_t *)pthread_getspecific(smr_key)) == NULL)
+		return 0;
+
+	head = __atomic_load_n(&node->defer_list, __ATOMIC_RELAXED);
+	do {
+		work->next = head;
+	}
+	while (!__atomic_compare_exchange_n(&node->defer_list, &head, work, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	__atomic_store_n(&node->defers, node->defers + 1, __ATOMIC_RELAXED);
+	pending = node->defers - __atomic_load_n(&node->collected, __ATOMIC_RELAXED);
+
+	return (pending != 0) ? pending : 1;		// 1 if already collected
+}
+
+
+//-----------------------------------------------------------------------------
+// smr_collect_node -- steal thread's deferred work in bulk
+//
+//	rcu_mutex held.  work is queued in fifo order for rcu pass 1.
+//-----------------------------------------------------------------------------
+int smr_collect_node(smr_node_t *node) {
+	rcu_defer_t	*workqueue;
+	rcu_defer_t	*work;
+	rcu_defer_t	*fifoqueue = NULL;
+	int			n = 0;
+
+	if (__atomic_load_n(&node->defer_list, __ATOMIC_SEQ_CST) == NULL)
+		return 0;
+
+	workqueue = __atomic_exchange_n(&node->defer_list, NULL, __ATOMIC_ACQUIRE);
+
+	// reverse lifo
+	while ((work = workqueue) != NULL) {
+		workqueue = work->next;
+		work->next = fifoqueue;
+		fifoqueue = work;
+		n++;
+	}
+
+	while ((work = fifoqueue) != NULL) {
+		fifoqueue = work->next;
+		work->sequence = current - 1;
+		rcu_enqueue(work, pass1);
+	}
+
+	__atomic_store_n(&node->collected, node->collected + n, __ATOMIC_RELAXED);
+	stats.defers += n;
+	deferred_work += n;
+
+	return n;
+}
+
+
+//-----------------------------------------------------------------------------
+// smr_collect -- steal all threads' deferred work
+//
+//	rcu_mutex held.  returns count of work collected.
+//-----------------------------------------------------------------------------
+int smr_collect() {
+	smr_node_t	*node;
+	int			n = 0;
+
+	for (node = smr_node_queue; node != NULL; node = node->next)
+		n += smr_collect_node(node);
+
+	return n;
+}
+
+
+//-----------------------------------------------------------------------------
+// smr_self -- calling thread's epoch slot, identifies its rcu node
+//
+//	returns NULL if thread has no smr node.
+//-----------------------------------------------------------------------------
+uint32_t *smr_self() {
+	smr_node_t	*node;
+
+	if ((node = (smr_node_t *)pthread_getspecific(smr_key)) == NULL)
+		return NULL;
+
+	return &(node->qepoch);
+}
+
+
+//-----------------------------------------------------------------------------
+// smr_qepoch -- publish calling thread's quiesce epoch
+//
+//	fenced both sides, hazard pointer stores before the quiesce point
+//	are visible before the epoch and later loads are not hoisted above
+//	it.  epoch 0 takes the thread offline.
+//-----------------------------------------------------------------------------
+void smr_qepoch(uint32_t epoch) {
+	smr_node_t	*node;
+
+	if ((node = (smr_node_t *)pthread_getspecific(smr_key)) == NULL)
+		return;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	__atomic_store_n(&(node->qepoch), epoch, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+
 //-----------------------------------------------------------------------------
 // smr_alloc --
 //-----------------------------------------------------------------------------
@@ -235,15 +485,9 @@ smr_t *smr_alloc() {
 	if ((node = (smr_node_t *)pthread_getspecific(smr_key)) == NULL)
 		return NULL;
 
-	// return next available hazard pointer in array
+	// return next available hazard pointer pair
 
-	if (node->ndx < node->hcount) {
-		hptr = &(node->hptr[2*node->ndx]);
-		node->ndx += 2;
-		// acquire membar
-	}
-
-	else
+	if ((hptr = smr_next(node)) == NULL)
 		abort();
 
 	return hptr;
@@ -270,7 +514,7 @@ void smr_dealloc(smr_t *hptr) {
 	// release membar ?
 	node->ndx -= 2;
 
-	if (hptr != &(node->hptr[2*node->ndx]))
+	if (hptr != smr_slot(node, node->ndx))
 		abort();
 
 	return;
@@ -315,7 +559,7 @@ void smr_shutdown() {
 	struct timespec nexttime;
 
 	while (smr_node_queue != NULL) {
-		next = getutimeofday();
+		next = getutime();
 		next += 10000;					// 10 msec
 
 		nexttime.tv_sec = utime_sec(next);
@@ -334,14 +578,21 @@ void smr_scan() {
 	smr_node_t	*node;
 	rcu_defer_t	*work;
 	rcu_defer_t	*workqueue;
+	smr_chunk_t	*chunk;
+	smr_t		*hazards;
 	int			ndx;
-	int			j;
+	int			j, k;
+	int			limit;
+	int			requeued = 0;
+	int			freed = 0;
 
 	if (smr_count == 0) {
 		stats.smrempty++;
 		return;
 	}
 
+	SMR_TRACE1(scan_start, smr_count);
+
 	current++;				// increment current sequence number
 
 	//
@@ -354,21 +605,35 @@ void smr_scan() {
 		node != NULL;
 		node = node->next)
 	{
-		ndx = node->ndx;
-		// acquire membar
+		ndx = __atomic_load_n(&(node->ndx), __ATOMIC_ACQUIRE);
 		if ((hsize - hcount) < ndx) {
 			hsize = (hsize * 2) + ndx;
 			hptr = (smr_t *)realloc(hptr, (hsize * sizeof(smr_t)));
 			if (hptr == NULL)
 				abort();
 		}
-		for (j = 0; j < ndx; j += 2) {
-			hptr[hcount++] = atomic_load(&(node->hptr[j + 0]));
-			rmb();		// load/load memory barrier
-			hptr[hcount++] = atomic_load(&(node->hptr[j + 1]));
+
+		// inline hazard pointers, then chunks
+		hazards = node->hptr;
+		limit = SMR_HPTRS;
+		chunk = NULL;
+		for (j = 0, k = 0; j < ndx; j += 2, k += 2) {
+			if (k >= limit) {
+				chunk = (chunk == NULL) ? node->chunks : chunk->next;
+				hazards = chunk->hptr;
+				limit = SMR_CHUNK;
+				k = 0;
+			}
+			if ((hptr[hcount] = atomic_load(&(hazards[k + 0]))) != NULL)
+				hcount++;
+			rmb();		// load/load memory barrier, stores ordered by rcu or membarrier
+			if ((hptr[hcount] = atomic_load(&(hazards[k + 1]))) != NULL)
+				hcount++;
 		}
 	}
 
+	hcount = smr_sort(hptr, hcount);
+
 	workqueue = fifo_dequeueall(&smr_queue);
 
 	//
@@ -376,10 +641,8 @@ void smr_scan() {
 	//
 	for (work = workqueue; work != 0; work = work->next) {
 
-		for (j = 0; j < hcount && hptr[j] != work->arg; j++) {}
-
 		// work still referenced by hazard pointers
-		if (j < hcount) {
+		if (smr_hazard(hptr, hcount, work->arg)) {
 
 			switch (work->type) {
 
@@ -416,12 +679,18 @@ void smr_scan() {
 	while((work = workqueue) != NULL) {
 		workqueue = work->next;		// dequeue
 
-		if (work->sequence == current)
+		if (work->sequence == current) {
 			fifo_enqueue(&smr_queue, work);		// requeue
-		else
+			requeued++;
+		}
+		else {
 			rcu_enqueue(work, pass2);			// dequeue
+			freed++;
+		}
 	}
 
+	SMR_TRACE3(scan_end, hcount, requeued, freed);
+
 
 	// update stats
 
@@ -0,0 +1,58 @@
+/*
+Copyright 2005, 2006 Joseph W. Seigh 
+
+Permission to use, copy, modify and distribute this software
+and its documentation for any purpose and without fee is
+hereby granted, provided that the above copyright notice
+appear in all copies, that both the copyright notice and this
+permission notice appear in supporting documentation.  I make
+no representations about the suitability of this software for
+any purpose. It is provided "as is" without express or implied
+warranty.
+
+---
+*/
+
+//------------------------------------------------------------------------------
+// smrtrace.h -- USDT tracepoints, provider fastsmr
+//
+// version -- 0.0.1 (pre-alpha)
+//
+// A probe is a nop until a tracer attaches, e.g.
+//
+//   bpftrace -e 'usdt:./app:fastsmr:scan_end { @h = hist(arg0); }'
+//
+// probes:
+//   defer(work, pending)               smr_defer, work uncollected/deferred
+//   scan_start(smr_count)              smr_scan with work waiting on hazards
+//   scan_end(hcount, requeued, freed)  hazards seen, work still/no longer held
+//   work(count, bytes)                 callback pass on the polling thread
+//   batch(count, bytes)                callback batch on a reclaimer thread
+//
+// Built in if <sys/sdt.h> (systemtap sdt) is available, unless
+// SMR_NOTRACE is defined.
+//
+//------------------------------------------------------------------------------
+
+
+#ifndef SMRTRACE_H
+#define SMRTRACE_H
+
+#if !defined(SMR_NOTRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SMR_TRACE 1
+#endif
+#endif
+
+#ifdef SMR_TRACE
+#define SMR_TRACE1(name, a)			DTRACE_PROBE1(fastsmr, name, a)
+#define SMR_TRACE2(name, a, b)		DTRACE_PROBE2(fastsmr, name, a, b)
+#define SMR_TRACE3(name, a, b, c)	DTRACE_PROBE3(fastsmr, name, a, b, c)
+#else
+#define SMR_TRACE1(name, a)
+#define SMR_TRACE2(name, a, b)
+#define SMR_TRACE3(name, a, b, c)
+#endif
+
+#endif /* SMRTRACE_H */
@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 #include <pthread.h>
+#include <stdint.h>
 
 //#include <atomix.h>
 #include <qcount.h>
@@ -54,6 +55,21 @@ static inline void pthread_mutex_unlockx(pthread_mutex_t *mutex) {
 	}
 }
 
+//------------------------------------------------------------------------------
+// pthread_cond_initx -- condvar with CLOCK_MONOTONIC timed waits, see getutime
+//------------------------------------------------------------------------------
+static inline void pthread_cond_initx(pthread_cond_t *cvar) {
+	pthread_condattr_t	attr;
+
+	if (pthread_condattr_init(&attr) != 0
+		|| pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0
+		|| pthread_cond_init(cvar, &attr) != 0)
+	{
+		abort();
+	}
+	pthread_condattr_destroy(&attr);
+}
+
 
 //------------------------------------------------------------------------------
 // Fifo defer queue
@@ -82,11 +98,19 @@ extern fifo_t			ready_queue;
 extern qcount_t			qcobj;					// qcount object
 extern sequence_t			current;				// current sequence number
 extern int				deferred_work;
+extern uint32_t			*rcu_self;				// scanning thread quiesced
+extern int				rcu_membarrier;			// membarrier backend in effect
+extern int				rcu_epoch;				// epoch backend in effect
+extern uint32_t			rcu_gp_epoch;			// grace period epoch
 
 //------------------------------------------------------------------------------
 extern void rcu_enqueue(rcu_defer_t *, rcu_defer_state_t);
 extern void smr_enqueue(rcu_defer_t *);
 extern void smr_scan();
+extern unsigned int smr_push(rcu_defer_t *);
+extern int smr_collect();
+extern uint32_t *smr_self();
+extern void smr_qepoch(uint32_t);
 extern void rcu_scan();
 extern int smr_check();
 extern void rcu_shutdown2();
@@ -101,7 +125,8 @@ extern void smr_chgref_cb(rcu_defer_t *);
 
 
 //------------------------------------------------------------------------------
-extern void rcu_add_node(qhandle_t);
+extern void rcu_add_node(qhandle_t, uint32_t *);
+extern void rcu_delete_node(uint32_t *);
 
 
 
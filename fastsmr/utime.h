@@ -17,7 +17,10 @@ warranty.
 //
 // version -- 0.0.0 (pre-alpha)
 //
-//
+// getutimeofday is wall clock time.  getutime and getntime are monotonic,
+// for intervals and for timed waits on condvars using CLOCK_MONOTONIC.
+// CLOCK_MONOTONIC is read through the vDSO from the cycle counter (TSC,
+// cntvct) w/o a system call.
 //
 //------------------------------------------------------------------------------
 
@@ -33,6 +36,7 @@ extern "C" {
 #endif
 
 #define MICROSEC 1000000
+#define NANOSEC 1000000000
 
 #define utime_sec(t)  ((int)((t)/MICROSEC))
 #define utime_usec(t) ((int)((t)%MICROSEC))
@@ -45,8 +49,10 @@ extern "C" {
 #define timeval_utime(p) ((((utime_t)(p).tv_sec * MICROSEC) + (utime_t)(p).tv_usec))
 #define timespec_utime(p) ((((utime_t)(p).tv_sec * MICROSEC) + (utime_t)((p).tv_nsec)/1000))
 #define timestruc_utime(p) ((((utime_t)(p).tv_sec * MICROSEC) + (utime_t)((p).tv_nsec)/1000))
+#define timespec_ntime(p) ((((ntime_t)(p).tv_sec * NANOSEC) + (ntime_t)((p).tv_nsec)))
 	
 typedef unsigned long long  utime_t;        // time_t in usecs (microseconds)
+typedef unsigned long long  ntime_t;        // monotonic time in nsecs (nanoseconds)
 
 //-----------------------------------------------------------------------------
 // getutimeofday -- get current time in microseconds
@@ -57,6 +63,22 @@ static inline utime_t getutimeofday() {
 	return timeval_utime(x);
 }
 
+//-----------------------------------------------------------------------------
+// getntime -- get monotonic time in nanoseconds
+//-----------------------------------------------------------------------------
+static inline ntime_t getntime() {
+	struct	timespec x;
+	clock_gettime(CLOCK_MONOTONIC, &x);
+	return timespec_ntime(x);
+}
+
+//-----------------------------------------------------------------------------
+// getutime -- get monotonic time in microseconds
+//-----------------------------------------------------------------------------
+static inline utime_t getutime() {
+	return (utime_t)(getntime() / 1000);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,289 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// hash_map.hpp -- read-mostly hash map, see reclaim.hpp
+//
+//   Lookups are lock-free, updates are serialized by a mutex.  Buckets are
+// singly linked chains.  An insert links a new node at the head of its
+// chain, erase and assign unlink the node (assign links a replacement
+// copy in its place) and retire it.  A node is marked erased before it is
+// unlinked, so a reader that sees its node unmarked after protecting the
+// next node knows the next node was still linked, otherwise the reader
+// restarts from the bucket.
+//
+//   The bucket array doubles when the map holds more entries than
+// buckets.  The new table gets copies of the nodes, is published, and
+// the old table is retired with its nodes, so readers still walking the
+// old table see it unchanged.  Keys and values must be copyable.
+//
+// protect slots:
+//   0       table
+//   1, 2    current and next node, alternating
+//
+//------------------------------------------------------------------------------
+
+#ifndef LFDS_HASH_MAP_HPP
+#define LFDS_HASH_MAP_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+#include "reclaim.hpp"
+
+namespace lfds {
+
+template<typename K, typename V, typename Policy, typename Hash = std::hash<K>>
+class hash_map {
+	public:
+		// bits is the log2 initial bucket count, at least 1 for index()
+		explicit hash_map(unsigned int bits = 4) : count(0) {
+			tab.store(new table((bits > 0) ? bits : 1), std::memory_order_relaxed);
+		}
+
+		~hash_map() {
+			delete tab.load(std::memory_order_relaxed);
+		}
+
+		//-----------------------------------------------------------------
+		// find -- copy value out, false if not found
+		//-----------------------------------------------------------------
+		bool find(const K & key, V & value) {
+			typename Policy::guard	g(reclaim);
+			table *	t = g.protect(0, tab);
+			node *	n;
+
+			if ((n = lookup(g, t, key)) == NULL)
+				return false;
+			value = n->value;
+			return true;
+		}
+
+		bool contains(const K & key) {
+			typename Policy::guard	g(reclaim);
+			table *	t = g.protect(0, tab);
+
+			return lookup(g, t, key) != NULL;
+		}
+
+		//-----------------------------------------------------------------
+		// insert -- false if key present
+		//-----------------------------------------------------------------
+		bool insert(const K & key, const V & value) {
+			std::lock_guard<std::mutex>	lock(mutex);
+			table *	t = tab.load(std::memory_order_relaxed);
+			std::atomic<node *> &	bucket = t->bucket[t->index(Hash()(key))];
+
+			if (locate(bucket, key) != NULL)
+				return false;
+			link(bucket, new node(key, value));
+			return true;
+		}
+
+		//-----------------------------------------------------------------
+		// assign -- insert or replace, true if inserted
+		//-----------------------------------------------------------------
+		bool assign(const K & key, const V & value) {
+			std::lock_guard<std::mutex>	lock(mutex);
+			table *	t = tab.load(std::memory_order_relaxed);
+			std::atomic<node *> &	bucket = t->bucket[t->index(Hash()(key))];
+			std::atomic<node *> *	prev;
+			node *	old;
+			node *	n;
+
+			if ((prev = locate(bucket, key)) == NULL) {
+				link(bucket, new node(key, value));
+				return true;
+			}
+
+			old = prev->load(std::memory_order_relaxed);
+			n = new node(key, value);
+			n->next.store(old->next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			old->erased.store(true, std::memory_order_release);
+			prev->store(n, std::memory_order_release);
+			reclaim.retire(old);
+			return false;
+		}
+
+		//-----------------------------------------------------------------
+		// erase -- false if not found
+		//-----------------------------------------------------------------
+		bool erase(const K & key) {
+			std::lock_guard<std::mutex>	lock(mutex);
+			table *	t = tab.load(std::memory_order_relaxed);
+			std::atomic<node *> *	prev;
+			node *	old;
+
+			if ((prev = locate(t->bucket[t->index(Hash()(key))], key)) == NULL)
+				return false;
+
+			old = prev->load(std::memory_order_relaxed);
+			old->erased.store(true, std::memory_order_release);
+			prev->store(old->next.load(std::memory_order_relaxed), std::memory_order_release);
+			count.store(count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+			reclaim.retire(old);
+			return true;
+		}
+
+		size_t size() { return count.load(std::memory_order_relaxed); }
+
+		size_t buckets() {
+			std::lock_guard<std::mutex>	lock(mutex);
+			return tab.load(std::memory_order_relaxed)->mask + 1;
+		}
+
+		Policy & reclaimer() { return reclaim; }
+
+	private:
+		struct node : Policy::hook {
+			node(const K & k, const V & v) : next(NULL), erased(false), key(k), value(v) {}
+
+			std::atomic<node *>	next;
+			std::atomic<bool>	erased;		// set before unlink
+			const K				key;
+			V					value;
+		};
+
+		struct table : Policy::hook {
+			explicit table(unsigned int n) : bits(n), mask(((size_t)1 << n) - 1) {
+				bucket = new std::atomic<node *>[mask + 1];
+				for (size_t ndx = 0; ndx <= mask; ndx++)
+					bucket[ndx].store(NULL, std::memory_order_relaxed);
+			}
+
+			// the table's nodes, erased nodes are retired on their own
+			~table() {
+				node *	n;
+				node *	next;
+
+				for (size_t ndx = 0; ndx <= mask; ndx++) {
+					for (n = bucket[ndx].load(std::memory_order_relaxed); n != NULL; n = next) {
+						next = n->next.load(std::memory_order_relaxed);
+						delete n;
+					}
+				}
+				delete [] bucket;
+			}
+
+			// fibonacci hash, high bits, std::hash is often the identity
+			size_t index(size_t h) const {
+				return (size_t)(((uint64_t)h * 0x9e3779b97f4a7c15ull) >> (64 - bits)) & mask;
+			}
+
+			unsigned int			bits;
+			size_t					mask;
+			std::atomic<node *> *	bucket;
+		};
+
+		//-----------------------------------------------------------------
+		// lookup -- protected walk of key's chain
+		//-----------------------------------------------------------------
+		node * lookup(typename Policy::guard & g, table * t, const K & key) {
+			std::atomic<node *> &	bucket = t->bucket[t->index(Hash()(key))];
+			node *	n;
+			node *	next;
+			int		slot;
+			bool	restart;
+
+			do {
+				restart = false;
+				slot = 1;
+				n = g.protect(slot, bucket);
+				while (n != NULL && !(n->key == key)) {
+					slot ^= 3;
+					next = g.protect(slot, n->next);
+					if (n->erased.load(std::memory_order_acquire)) {
+						restart = true;			// unlinked, next may be too
+						break;
+					}
+					n = next;
+				}
+			}
+			while (restart);
+
+			return n;
+		}
+
+		//-----------------------------------------------------------------
+		// locate -- link to key's node, NULL if none, mutex held
+		//-----------------------------------------------------------------
+		std::atomic<node *> * locate(std::atomic<node *> & bucket, const K & key) {
+			std::atomic<node *> *	prev = &bucket;
+			node *	n;
+
+			while ((n = prev->load(std::memory_order_relaxed)) != NULL) {
+				if (n->key == key)
+					return prev;
+				prev = &n->next;
+			}
+			return NULL;
+		}
+
+		//-----------------------------------------------------------------
+		// link -- link new node at chain head, grow if over, mutex held
+		//-----------------------------------------------------------------
+		void link(std::atomic<node *> & bucket, node * n) {
+			size_t	total = count.load(std::memory_order_relaxed) + 1;
+
+			n->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			bucket.store(n, std::memory_order_release);
+			count.store(total, std::memory_order_relaxed);
+
+			if (total > tab.load(std::memory_order_relaxed)->mask + 1)
+				grow();
+		}
+
+		//-----------------------------------------------------------------
+		// grow -- double bucket array, copying nodes, mutex held
+		//-----------------------------------------------------------------
+		void grow() {
+			table *	old = tab.load(std::memory_order_relaxed);
+			table *	t = new table(old->bits + 1);
+			node *	n;
+			node *	copy;
+
+			for (size_t ndx = 0; ndx <= old->mask; ndx++) {
+				for (n = old->bucket[ndx].load(std::memory_order_relaxed); n != NULL; n = n->next.load(std::memory_order_relaxed)) {
+					std::atomic<node *> &	bucket = t->bucket[t->index(Hash()(n->key))];
+
+					copy = new node(n->key, n->value);
+					copy->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+					bucket.store(copy, std::memory_order_relaxed);
+				}
+			}
+
+			tab.store(t, std::memory_order_release);
+			reclaim.retire(old);
+		}
+
+		hash_map(const hash_map &);
+		hash_map & operator = (const hash_map &);
+
+		alignas(128) std::atomic<table *>	tab;
+		std::atomic<size_t>					count;
+		std::mutex							mutex;
+		Policy								reclaim;
+};
+
+} // namespace lfds
+
+#endif /* LFDS_HASH_MAP_HPP */
+
+
+/*-*/
@@ -0,0 +1,168 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// queue.hpp -- MPMC linked queue (Michael & Scott), see reclaim.hpp
+//
+//   head is a dummy node, the first value is in head->next.  pop swings
+// head to next and moves the value out of next, which becomes the new
+// dummy, so values live in raw storage and a dummy has none.  The old
+// head is retired.  Links are only CASed while the node is protected,
+// so retired nodes are not reused under a CAS and there is no ABA.
+//
+// protect slots:
+//   0   tail (push), head (pop)
+//   1   head->next (pop)
+//
+//------------------------------------------------------------------------------
+
+#ifndef LFDS_QUEUE_HPP
+#define LFDS_QUEUE_HPP
+
+#include <stddef.h>
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "reclaim.hpp"
+
+namespace lfds {
+
+template<typename T, typename Policy>
+class queue {
+	public:
+		queue() {
+			node * dummy = new node();
+
+			head.store(dummy, std::memory_order_relaxed);
+			tail.store(dummy, std::memory_order_relaxed);
+		}
+
+		~queue() {
+			node *	n = head.load(std::memory_order_relaxed);
+			node *	next;
+
+			for (bool dummy = true; n != NULL; n = next, dummy = false) {
+				next = n->next.load(std::memory_order_relaxed);
+				if (!dummy)
+					n->get()->~T();
+				delete n;
+			}
+		}
+
+		void push(const T & value) {
+			enqueue(new node(value));
+		}
+
+		void push(T && value) {
+			enqueue(new node(std::move(value)));
+		}
+
+		//-----------------------------------------------------------------
+		// pop -- false if empty
+		//-----------------------------------------------------------------
+		bool pop(T & value) {
+			typename Policy::guard	g(reclaim);
+			node *	first;
+			node *	last;
+			node *	next;
+
+			for (;;) {
+				first = g.protect(0, head);
+				last = tail.load(std::memory_order_acquire);
+				next = g.protect(1, first->next);
+				if (first != head.load(std::memory_order_acquire))
+					continue;
+				if (next == NULL)
+					return false;
+				if (first == last) {				// tail lagging
+					tail.compare_exchange_strong(last, next, std::memory_order_release, std::memory_order_relaxed);
+					continue;
+				}
+				if (head.compare_exchange_strong(first, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+					break;
+			}
+
+			value = std::move(*next->get());
+			next->get()->~T();
+			g.release(1);
+			g.release(0);
+			reclaim.retire(first);
+			return true;
+		}
+
+		bool empty() {
+			typename Policy::guard	g(reclaim);
+			node *	first = g.protect(0, head);
+
+			return first->next.load(std::memory_order_acquire) == NULL;
+		}
+
+		Policy & reclaimer() { return reclaim; }
+
+	private:
+		struct node : Policy::hook {
+			node() : next(NULL) {}
+
+			explicit node(const T & value) : next(NULL) {
+				new (storage) T(value);
+			}
+
+			explicit node(T && value) : next(NULL) {
+				new (storage) T(std::move(value));
+			}
+
+			T * get() { return (T *)storage; }
+
+			std::atomic<node *>		next;
+			alignas(T) unsigned char	storage[sizeof(T)];	// value, none if dummy
+		};
+
+		void enqueue(node * n) {
+			typename Policy::guard	g(reclaim);
+			node *	last;
+			node *	next;
+
+			for (;;) {
+				last = g.protect(0, tail);
+				next = last->next.load(std::memory_order_acquire);
+				if (last != tail.load(std::memory_order_acquire))
+					continue;
+				if (next != NULL) {					// tail lagging
+					tail.compare_exchange_strong(last, next, std::memory_order_release, std::memory_order_relaxed);
+					continue;
+				}
+				if (last->next.compare_exchange_weak(next, n, std::memory_order_release, std::memory_order_relaxed))
+					break;
+			}
+
+			tail.compare_exchange_strong(last, n, std::memory_order_release, std::memory_order_relaxed);
+		}
+
+		queue(const queue &);
+		queue & operator = (const queue &);
+
+		alignas(128) std::atomic<node *>	head;
+		alignas(128) std::atomic<node *>	tail;
+		Policy								reclaim;
+};
+
+} // namespace lfds
+
+#endif /* LFDS_QUEUE_HPP */
+
+
+/*-*/
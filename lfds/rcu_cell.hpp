@@ -0,0 +1,151 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// rcu_cell.hpp -- snapshot publishing cell, see reclaim.hpp
+//
+//   A cell holds a pointer to an immutable T.  Readers take a snapshot,
+// which holds a guard and protects the pointer once, and dereference it
+// for the snapshot's scope.  With proxy_reclaim that is one proxy
+// reference and an acquire load however many times the snapshot is
+// dereferenced.  Writers publish a new T and the old one is retired
+// through the policy.
+//
+//     typedef lfds::proxy_reclaim<rcpc::proxy, rcpc::guard> reclaim;
+//     lfds::rcu_cell<config, reclaim> cell(new config());
+//
+//     { lfds::rcu_cell<config, reclaim>::snapshot s(cell); use(s->x, s->y); }
+//     cell.update(new config(...));
+//     cell.update([](const config & old) { config c(old); c.x++; return c; });
+//
+//   update(T *) publishes unconditionally.  update(f) is read-copy-update,
+// f(const T &) returns the new value, and retries if another writer
+// published first, so f may be called more than once.  A snapshot is the
+// thread's one guard, see reclaim.hpp.  With smr_reclaim T derives from
+// smr_reclaim::hook.
+//
+// protect slots:
+//   0   value
+//
+//------------------------------------------------------------------------------
+
+#ifndef LFDS_RCU_CELL_HPP
+#define LFDS_RCU_CELL_HPP
+
+#include <stddef.h>
+#include <atomic>
+#include <type_traits>
+#include <utility>
+
+#include "reclaim.hpp"
+
+namespace lfds {
+
+template<typename T, typename Policy>
+class rcu_cell {
+	public:
+		explicit rcu_cell(T * init = NULL) : ptr(init) {}
+
+		~rcu_cell() {
+			delete ptr.load(std::memory_order_relaxed);
+		}
+
+		//=================================================================
+		// snapshot -- protected value for the snapshot's scope
+		//=================================================================
+		class snapshot {
+			public:
+				explicit snapshot(rcu_cell & cell) : g(cell.reclaim) {
+					p = g.protect(0, cell.ptr);
+				}
+
+				const T * get() const { return p; }
+				const T & operator * () const { return *p; }
+				const T * operator -> () const { return p; }
+				explicit operator bool () const { return p != NULL; }
+
+			private:
+				void * operator new (size_t);		// auto only
+
+				snapshot(const snapshot &);
+				snapshot & operator = (const snapshot &);
+
+				typename Policy::guard	g;
+				T *		p;
+		};
+
+		//-----------------------------------------------------------------
+		// read -- f(const T &) on a snapshot, value must be set
+		//-----------------------------------------------------------------
+		template<typename F>
+		auto read(F f) -> decltype(f(std::declval<const T &>())) {
+			snapshot	s(*this);
+
+			return f(*s);
+		}
+
+		//-----------------------------------------------------------------
+		// update -- publish next, retire the old value
+		//-----------------------------------------------------------------
+		void update(T * next) {
+			T *	old = ptr.exchange(next, std::memory_order_acq_rel);
+
+			if (old != NULL)
+				reclaim.retire(old);
+		}
+
+		//-----------------------------------------------------------------
+		// update -- read-copy-update, next value is f(old), value must be set
+		// (not for pointers, nullptr or NULL, those go to update(T *))
+		//-----------------------------------------------------------------
+		template<typename F, typename = typename std::enable_if<!std::is_convertible<F, T *>::value && !std::is_integral<F>::value>::type>
+		void update(F f) {
+			T *	old;
+			T *	next;
+
+			{
+				// old stays protected across the CAS, so its address
+				// can't be reused by a later value
+				typename Policy::guard	g(reclaim);
+
+				for (;;) {
+					old = g.protect(0, ptr);
+					next = new T(f((const T &)*old));
+					if (ptr.compare_exchange_strong(old, next, std::memory_order_acq_rel, std::memory_order_relaxed))
+						break;
+					delete next;			// another writer published first
+				}
+			}
+
+			reclaim.retire(old);
+		}
+
+		Policy & reclaimer() { return reclaim; }
+
+	private:
+		rcu_cell(const rcu_cell &);
+		rcu_cell & operator = (const rcu_cell &);
+
+		alignas(128) std::atomic<T *>	ptr;
+		Policy							reclaim;
+};
+
+} // namespace lfds
+
+#endif /* LFDS_RCU_CELL_HPP */
+
+
+/*-*/
@@ -0,0 +1,102 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// reclaim.hpp -- reclamation policies for the lfds containers
+//
+//   Each container (queue.hpp, stack.hpp, hash_map.hpp, rcu_cell.hpp) takes
+// a policy that protects the nodes a thread is reading and defers deletion
+// of the nodes it unlinks until no thread can be reading them.
+//
+//   policy interface:
+//     struct hook                      base of every retired object
+//     class guard                      protection for the guard's scope
+//       guard(Policy &)
+//       T * protect(int ndx, const std::atomic<T *> &)
+//                                      load pointer, protected as slot ndx
+//                                      until released or reprotected
+//       void release(int ndx)
+//     enum { SLOTS }                   protect slots per guard
+//     void retire<T, Deleter>(T *)     delete once no guard protects it
+//     void quiesce()                   quiesce point, call outside guards
+//
+//   proxy_reclaim adapts stpc.hpp or rcpc.hpp.  Its guard holds a proxy
+// node reference, which covers everything read in the guard's scope, so
+// protect is an acquire load.  smr_reclaim (smr_reclaim.hpp) publishes
+// each protected pointer in a fastsmr hazard pointer.
+//
+//   A thread has one guard at a time, guards don't nest.
+//
+//     #include <stpc.hpp>
+//     #include <queue.hpp>
+//
+//     typedef lfds::proxy_reclaim<stpc::proxy, stpc::guard> reclaim;
+//     lfds::queue<int, reclaim> q;
+//
+//------------------------------------------------------------------------------
+
+#ifndef LFDS_RECLAIM_HPP
+#define LFDS_RECLAIM_HPP
+
+#include <atomic>
+#include <memory>
+
+namespace lfds {
+
+//=============================================================================
+// proxy_reclaim -- stpc/rcpc proxy collector policy
+//=============================================================================
+template<typename Proxy, typename Guard>
+class proxy_reclaim {
+	public:
+		struct hook {};					// no per object state
+
+		enum { SLOTS = 4 };
+
+		class guard {
+			public:
+				explicit guard(proxy_reclaim & src) : g(src.px) {}
+
+				template<typename T>
+				T * protect(int, const std::atomic<T *> & src) {
+					return src.load(std::memory_order_acquire);
+				}
+
+				void release(int) {}
+
+			private:
+				Guard	g;
+		};
+
+		template<typename T, typename Deleter = std::default_delete<T>>
+		void retire(T * obj) {
+			px.template retire<T, Deleter>(obj);
+		}
+
+		void quiesce() {}
+
+		Proxy & get() { return px; }
+
+	private:
+		Proxy	px;
+};
+
+} // namespace lfds
+
+#endif /* LFDS_RECLAIM_HPP */
+
+
+/*-*/
@@ -0,0 +1,154 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// smr_reclaim.hpp -- fastsmr hazard pointer policy, see reclaim.hpp
+//
+//   protect publishes the pointer in one of the thread's hazard pointers,
+// two pairs from smr_acquire on the thread's first guard, and reloads
+// the source until it is unchanged.  As in fastsmr itself there is no
+// memory barrier, the grace period ahead of the hazard pointer scan
+// makes the store visible.  The hook is the rcu_defer_t smr_defer
+// queues, so retire does not allocate.
+//
+//   rcu_startup must have been called.  Threads call quiesce (rcu_quiesce)
+// periodically outside guards so grace periods complete.
+//
+//------------------------------------------------------------------------------
+
+#ifndef LFDS_SMR_RECLAIM_HPP
+#define LFDS_SMR_RECLAIM_HPP
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+
+#include <fastsmr.h>
+
+namespace lfds {
+
+//=============================================================================
+// smr_reclaim -- fastsmr policy
+//=============================================================================
+class smr_reclaim {
+	public:
+		struct hook {
+			hook() : defer() {}
+			hook(const hook &) : defer() {}				// copies are not retired
+			hook & operator = (const hook &) { return *this; }
+
+			rcu_defer_t	defer;
+		};
+
+		enum { SLOTS = 4 };
+
+	private:
+		// thread's hazard pointers, 2 pairs
+		struct slots {
+			slots() {
+				if ((pair[0] = smr_acquire()) == NULL || (pair[1] = smr_acquire()) == NULL)
+					abort();
+			}
+
+			~slots() {
+				smr_dealloc(pair[1]);
+				smr_dealloc(pair[0]);
+			}
+
+			smr_t * slot(int ndx) { return &pair[ndx >> 1][ndx & 1]; }
+
+			smr_t *	pair[2];
+		};
+
+		static slots & local() {
+			static thread_local slots	hazards;
+			return hazards;
+		}
+
+	public:
+		class guard {
+			public:
+				explicit guard(smr_reclaim &) : hazards(local()) {}
+
+				~guard() {
+					std::atomic_signal_fence(std::memory_order_seq_cst);
+					for (int ndx = 0; ndx < SLOTS; ndx++)
+						__atomic_store_n(hazards.slot(ndx), (void *)NULL, __ATOMIC_RELAXED);
+				}
+
+				template<typename T>
+				T * protect(int ndx, const std::atomic<T *> & src) {
+					smr_t *	hptr = hazards.slot(ndx);
+					T *		p = src.load(std::memory_order_relaxed);
+					T *		q;
+
+					for (;;) {
+						__atomic_store_n(hptr, (void *)p, __ATOMIC_RELAXED);
+						std::atomic_signal_fence(std::memory_order_seq_cst);
+						if ((q = src.load(std::memory_order_acquire)) == p)
+							return p;
+						p = q;
+					}
+				}
+
+				void release(int ndx) {
+					std::atomic_signal_fence(std::memory_order_seq_cst);
+					__atomic_store_n(hazards.slot(ndx), (void *)NULL, __ATOMIC_RELAXED);
+				}
+
+			private:
+				void * operator new (size_t);		// auto only
+
+				guard(const guard &);
+				guard & operator = (const guard &);
+
+				slots &	hazards;
+		};
+
+		template<typename T, typename Deleter = std::default_delete<T>>
+		void retire(T * obj) {
+			static_assert(std::is_base_of<hook, T>::value, "retired type must derive from smr_reclaim::hook");
+
+			rcu_defer_t *	defer = &static_cast<hook *>(obj)->defer;
+
+			defer->func = &freeData<T, Deleter>;
+			defer->arg = (void *)obj;			// hazard pointer value
+			defer->forrefs = &noRefs;
+			defer->type = trace;
+			smr_defer_sized(defer, sizeof(T));
+		}
+
+		void quiesce() {
+			rcu_quiesce();
+		}
+
+	private:
+		template<typename T, typename Deleter>
+		static void freeData(void * data) {
+			Deleter()((T *)data);
+		}
+
+		static void noRefs(void *, int (*)(rcu_defer_t *)) {}	// no refs to trace
+};
+
+} // namespace lfds
+
+#endif /* LFDS_SMR_RECLAIM_HPP */
+
+
+/*-*/
@@ -0,0 +1,113 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// stack.hpp -- Treiber stack, see reclaim.hpp
+//
+//   push doesn't dereference head, so only pop takes a guard.  The popped
+// node is protected across its CAS, so it can't be retired and reused
+// under the CAS and there is no ABA.  The winner owns the value.
+//
+// protect slots:
+//   0   head (pop)
+//
+//------------------------------------------------------------------------------
+
+#ifndef LFDS_STACK_HPP
+#define LFDS_STACK_HPP
+
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+
+#include "reclaim.hpp"
+
+namespace lfds {
+
+template<typename T, typename Policy>
+class stack {
+	public:
+		stack() : head(NULL) {}
+
+		~stack() {
+			node *	n;
+
+			while ((n = head.load(std::memory_order_relaxed)) != NULL) {
+				head.store(n->next, std::memory_order_relaxed);
+				delete n;
+			}
+		}
+
+		void push(const T & value) {
+			link(new node(value));
+		}
+
+		void push(T && value) {
+			link(new node(std::move(value)));
+		}
+
+		//-----------------------------------------------------------------
+		// pop -- false if empty
+		//-----------------------------------------------------------------
+		bool pop(T & value) {
+			typename Policy::guard	g(reclaim);
+			node *	top;
+
+			do {
+				if ((top = g.protect(0, head)) == NULL)
+					return false;
+			}
+			while (!head.compare_exchange_weak(top, top->next, std::memory_order_acquire, std::memory_order_relaxed));
+
+			value = std::move(top->value);
+			g.release(0);
+			reclaim.retire(top);
+			return true;
+		}
+
+		bool empty() {
+			return head.load(std::memory_order_relaxed) == NULL;
+		}
+
+		Policy & reclaimer() { return reclaim; }
+
+	private:
+		struct node : Policy::hook {
+			explicit node(const T & src) : value(src) {}
+			explicit node(T && src) : value(std::move(src)) {}
+
+			node *	next;			// immutable once pushed
+			T		value;
+		};
+
+		void link(node * n) {
+			n->next = head.load(std::memory_order_relaxed);
+			while (!head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)) {}
+		}
+
+		stack(const stack &);
+		stack & operator = (const stack &);
+
+		alignas(128) std::atomic<node *>	head;
+		Policy								reclaim;
+};
+
+} // namespace lfds
+
+#endif /* LFDS_STACK_HPP */
+
+
+/*-*/
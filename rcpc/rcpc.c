@@ -15,8 +15,11 @@
  */
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <sched.h>
 
 #include <stdio.h>
 
@@ -24,11 +27,32 @@
 
 typedef long st_int_t;
 
+/*
+ * Cache line layout
+ * With RCPC_PADDED (default) independently written proxy fields are put on
+ * separate cache lines and nodes are allocated cache line aligned.
+ * Define RCPC_PADDED to 0 for the compact layout, RCPC_CACHE_LINE for
+ * 128 byte lines.
+ */
+#ifndef RCPC_CACHE_LINE
+#define RCPC_CACHE_LINE 64
+#endif
+#ifndef RCPC_PADDED
+#define RCPC_PADDED 1
+#endif
+
+#if RCPC_PADDED
+#define CACHE_ALIGNED _Alignas(RCPC_CACHE_LINE)
+#else
+#define CACHE_ALIGNED
+#endif
+
 typedef struct _rcpcNode {
-    struct _rcpcNode*	next;			// subsequent node
+    CACHE_ALIGNED struct _rcpcNode*	next;	// subsequent node
     st_int_t        sequence;		// (inclusive)
     st_int_t		prevSequence;   // (exclusive)
     st_int_t		count;			// reference count
+    bool			closed;			// sequence adjustment applied to count
     void            (*freeData)(void *);    // user supplied free data function
     void*			data;
 
@@ -36,25 +60,75 @@ typedef struct _rcpcNode {
     int				inuse;          // debug
 } rcpcNode;
 
+/*
+ * deferred delete parked on overflow list when no nodes available
+ */
+typedef struct _parkedData {
+	struct _parkedData*	next;
+	void            (*freeData)(void *);
+	void*			data;
+	long			parkTime;		// time parked (nsecs)
+} parkedData;
+
+/*
+ * per thread stats block, registry links and the adaptive latency window
+ * around the public counts, stats_t ends with latency[] so it goes last
+ */
+typedef struct _statsBlock {
+	struct _statsBlock*	next;		// proxy stats registry
+	int				inuse;			// registry block owned by a thread
+	long			windowTries;	// adaptive latency window, _addNode calls
+	long			windowFails;	// ...failed _addNode calls
+	stats_t			stats;
+} statsBlock;
+
+#define STATS_BLOCK(s) ((statsBlock *)((char *)(s) - offsetof(statsBlock, stats)))
+
+/*
+ * arena slab, nodes follow header
+ */
+typedef struct _rcpcSlab {
+	CACHE_ALIGNED struct _rcpcSlab*	next;
+} rcpcSlab;
+
 typedef struct _rcpcProxy {
-    st_int_t		sequence;
-    rcpcNode*         tail;			// referenced node tail
-    rcpcNode*         freeTail;		// referenced node head
-    rcpcNode*         freeHead;		// free unreferenced nodes if != head
+    CACHE_ALIGNED st_int_t		sequence;
+    CACHE_ALIGNED rcpcNode*     tail;			// referenced node tail
+    CACHE_ALIGNED rcpcNode*     freeTail;		// referenced node head
+    CACHE_ALIGNED rcpcNode*     freeHead;		// free unreferenced nodes if != head
 
     // set before initProxy
-    unsigned int	maxLatency;		// maximum latent node count
+    CACHE_ALIGNED unsigned int	maxLatency;		// maximum latent node count
     unsigned int    latency;        // max latency permitted for adding a node
+    bool            adaptive;       // adjust latency at runtime
+    unsigned int    minLatency;     // adaptive latency range
+    unsigned int    latencyCap;     // ...
     unsigned int	maxNodes;		// maximum nodes
 	void			*(*allocMem)(size_t);	// allocate memory function (default malloc)
 	void            (*freeMem)(void *);    // free memory function (default free)
     //
     bool            initialized;
     //
-    unsigned int	numNodes;		// current number of allocated nodes    
+    CACHE_ALIGNED unsigned int	numNodes;		// current number of allocated nodes    
+    unsigned int	trimNodes;		// free nodes owed by latency decreases
     //
-    pthread_key_t   statsKey;
-	struct _stats_t	*stats;
+    CACHE_ALIGNED pthread_key_t statsKey;
+	struct _stats_t	*stats;			// last snapshot
+    unsigned long	id;				// unique proxy id
+    statsBlock*		registry;		// per thread stats blocks
+    //
+    pthread_key_t   reclaimKey;		// thread local deferred free buffer
+    unsigned int	reclaimBudget;	// max data freed inline per drop, 0 unlimited
+    void			(*reclaimHandler)(void (*)(void *), void *, void *);	// hand off freed data if set
+    void*			reclaimArg;
+    //
+    CACHE_ALIGNED parkedData*	parked;			// overflow list, parked deferred deletes
+    bool			draining;		// overflow list being drained
+    //
+    CACHE_ALIGNED pthread_mutex_t	arenaLock;
+    unsigned int	nodesPerSlab;	// arena mode if != 0
+    rcpcSlab*		slabs;			// allocated slabs
+    rcpcNode*		spareNodes;		// arena nodes not in use by proxy
 } rcpcProxy;
 
 
@@ -64,14 +138,158 @@ typedef struct _rcpcProxy {
 #define INITIAL_SEQUENCE (GUARD_BIT + 0 * REFERENCE)
 #define DEFAULT_LATENCY 1
 
+#define ADAPT_WINDOW 64				// _addNode calls per thread between adjustments
+#define ADAPT_GROW 8				// grow if more than 1/ADAPT_GROW failed
+
 #define COMPARE(a, b) (a - b)
 
+/*
+ * data released by the drop walk, deferred past the reclaim budget
+ */
+typedef struct _reclaimItem {
+	void            (*freeData)(void *);
+	void*			data;
+} reclaimItem;
+
+/*
+ * thread local deferred free buffer, ring of reclaim items
+ */
+typedef struct _reclaimBuffer {
+	rcpcProxy*		proxy;
+	reclaimItem*	items;
+	size_t			head;
+	size_t			count;
+	size_t			size;
+} reclaimBuffer;
+
+#define RECLAIM_SIZE 64
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p)
+#endif
+
+/*
+ * USDT tracepoints, provider rcpc.  A nop until a tracer attaches, e.g.
+ *   bpftrace -e 'usdt:./app:rcpc:add_node /arg2 == 0/ { @fail = count(); }'
+ * Built in if <sys/sdt.h> is available unless RCPC_NOTRACE is defined.
+ *
+ *   get_ref(proxy, node, latency)                   nodes walked to reference
+ *   drop_ref(proxy, node, recycled)                 nodes recycled by the drop
+ *   add_node(proxy, node, rc, attempts, latency)    rc 0 is a failed add
+ *   new_node_alloc(proxy, node, numNodes)           free list empty, allocMem fallback
+ *   backoff(proxy, maxNodes)                        deferred delete blocked on maxNodes
+ *   backoff_done(proxy, backoffs, nanos)
+ */
+#if !defined(RCPC_NOTRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RCPC_TRACE 1
+#endif
+#endif
+
+#ifdef RCPC_TRACE
+#define TRACE2(name, a, b)			DTRACE_PROBE2(rcpc, name, a, b)
+#define TRACE3(name, a, b, c)		DTRACE_PROBE3(rcpc, name, a, b, c)
+#define TRACE5(name, a, b, c, d, e)	DTRACE_PROBE5(rcpc, name, a, b, c, d, e)
+#else
+#define TRACE2(name, a, b)
+#define TRACE3(name, a, b, c)
+#define TRACE5(name, a, b, c, d, e)
+#endif
+
 stats_t * _allocStats(rcpcProxy *proxy);
 stats_t * rcpcGetLocalStats(rcpcProxy *proxy);
 void _freeStats(void *data);
+unsigned int _drainParked(rcpcProxy *proxy);
+void _deleteStats(rcpcProxy *proxy);
+void _freeReclaimBuffer(void *data);
+static void _deleteReclaim(rcpcProxy *proxy);
+static unsigned long _proxyIds;
+
+/*
+ * Cache line aligned allocation through allocMem
+ */
+static void * _allocAligned(void *(allocMem)(size_t), size_t sz) {
+#if RCPC_PADDED
+	char *mem = allocMem(sz + RCPC_CACHE_LINE + sizeof(void *));
+	if (mem == NULL)
+		return NULL;
+	char *ptr = (char *)(((uintptr_t)mem + sizeof(void *) + RCPC_CACHE_LINE - 1) & ~(uintptr_t)(RCPC_CACHE_LINE - 1));
+	((void **)ptr)[-1] = mem;
+	return ptr;
+#else
+	return allocMem(sz);
+#endif
+}
+
+static void _freeAligned(void (*freeMem)(void *), void *ptr) {
+#if RCPC_PADDED
+	freeMem(((void **)ptr)[-1]);
+#else
+	freeMem(ptr);
+#endif
+}
+
+/*
+ * Arena node store
+ * Nodes are carved out of cache line aligned slabs of nodesPerSlab nodes
+ * and returned to the arena instead of being freed.  Slabs are freed when
+ * the proxy is deleted.  Only used when the free list is empty.
+ */
+rcpcNode* _arenaNode(rcpcProxy *proxy) {
+	rcpcNode *node;
+	rcpcSlab *slab;
+
+	pthread_mutex_lock(&proxy->arenaLock);
+	if (proxy->spareNodes == NULL) {
+		slab = _allocAligned(proxy->allocMem, sizeof(rcpcSlab) + proxy->nodesPerSlab * sizeof(rcpcNode));
+		if (slab != NULL) {
+			slab->next = proxy->slabs;
+			proxy->slabs = slab;
+
+			node = (rcpcNode *)(slab + 1);
+			for (unsigned int ndx = 0; ndx < proxy->nodesPerSlab; ndx++) {
+				node[ndx].next = proxy->spareNodes;
+				proxy->spareNodes = &node[ndx];
+			}
+		}
+	}
+
+	if ((node = proxy->spareNodes) != NULL)
+		proxy->spareNodes = node->next;
+	pthread_mutex_unlock(&proxy->arenaLock);
+
+	return node;
+}
+
+static rcpcNode* _allocNode(rcpcProxy *proxy) {
+	if (proxy->nodesPerSlab != 0)
+		return _arenaNode(proxy);
+	else
+		return _allocAligned(proxy->allocMem, sizeof(rcpcNode));
+}
+
+static void _freeNode(rcpcProxy *proxy, rcpcNode *node) {
+	if (proxy->nodesPerSlab != 0) {
+		pthread_mutex_lock(&proxy->arenaLock);
+		node->next = proxy->spareNodes;
+		proxy->spareNodes = node;
+		pthread_mutex_unlock(&proxy->arenaLock);
+	}
+	else
+		_freeAligned(proxy->freeMem, node);
+}
+
+static long _nanotime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
 
 rcpcProxy * rcpcNewProxyM(void *(allocMem)(size_t), void (*freeMem)(void *)) {
-	rcpcProxy* proxy = allocMem(sizeof(rcpcProxy));
+	rcpcProxy* proxy = _allocAligned(allocMem, sizeof(rcpcProxy));
 	memset(proxy, 0, sizeof(rcpcProxy));
 	proxy->sequence = INITIAL_SEQUENCE;
 
@@ -85,6 +303,9 @@ rcpcProxy * rcpcNewProxyM(void *(allocMem)(size_t), void (*freeMem)(void *)) {
     
     proxy->initialized = false;
 
+    pthread_mutex_init(&proxy->arenaLock, NULL);
+    pthread_key_create(&proxy->reclaimKey, &_freeReclaimBuffer);
+
 	/*-*/
 
 	return proxy;
@@ -94,18 +315,49 @@ rcpcProxy *rcpcNewProxy() {
 	return rcpcNewProxyM(malloc, free);
 }
 
-void rcpcInitProxy(rcpcProxy *proxy) {
+/*
+ * Arena proxy
+ * Nodes come from slabs of nodesPerSlab nodes.  If maxNodes is set
+ * before initProxy, all maxNodes nodes are preallocated onto the free list.
+ */
+rcpcProxy * rcpcNewProxyArenaM(unsigned int nodesPerSlab, void *(allocMem)(size_t), void (*freeMem)(void *)) {
+	rcpcProxy *proxy = rcpcNewProxyM(allocMem, freeMem);
+
+	proxy->nodesPerSlab = (nodesPerSlab > 0) ? nodesPerSlab : 1;
+	return proxy;
+}
+
+rcpcProxy *rcpcNewProxyArena(unsigned int nodesPerSlab) {
+	return rcpcNewProxyArenaM(nodesPerSlab, malloc, free);
+}
+
+bool rcpcInitProxy(rcpcProxy *proxy) {
     if (proxy->initialized)
-        return;
+        return true;
     
-    proxy->maxLatency = proxy->latency + 2;
+    if (proxy->adaptive) {
+        if (proxy->latency < proxy->minLatency)
+            proxy->latency = proxy->minLatency;
+        if (proxy->latency > proxy->latencyCap)
+            proxy->latency = proxy->latencyCap;
+        proxy->maxLatency = proxy->latencyCap + 2;		// latent nodes and histogram for cap
+    }
+    else
+        proxy->maxLatency = proxy->latency + 2;
     
+    proxy->id = atomic_fetch_add_explicit(&_proxyIds, 1, memory_order_relaxed) + 1;
     pthread_key_create(&proxy->statsKey, &_freeStats);
     proxy->stats = _allocStats(proxy);
+    if (proxy->stats == NULL) {
+        pthread_key_delete(proxy->statsKey);
+        return false;
+    }
     
     // allocate current node
 
-	rcpcNode* node = malloc(sizeof(rcpcNode));
+	rcpcNode* node = _allocNode(proxy);
+	if (node == NULL)
+		goto fail;
 	memset(node, 0, sizeof(rcpcNode));
 
 	node->next = NULL;
@@ -120,9 +372,11 @@ void rcpcInitProxy(rcpcProxy *proxy) {
 
     // allocate latent nodes
         
-	rcpcNode* latentNode;
+	rcpcNode* latentNode = node;
 	for (int j = 0; j < proxy->maxLatency; j++) {
-		latentNode = proxy->allocMem(sizeof(rcpcNode));
+		latentNode = _allocNode(proxy);
+		if (latentNode == NULL)
+			goto fail;
 		memset(latentNode, 0, sizeof(rcpcNode));
 
 		latentNode->next = node;
@@ -140,24 +394,69 @@ void rcpcInitProxy(rcpcProxy *proxy) {
 	proxy->freeTail = latentNode;
 	proxy->freeHead = latentNode;
 
+    // preallocate arena nodes in front of free list head, on arena
+    // exhaustion the rest are allocated on demand as in the non-arena path
+    if (proxy->nodesPerSlab != 0 && proxy->maxNodes != UINT32_MAX) {
+        while (proxy->numNodes < proxy->maxNodes && (node = _arenaNode(proxy)) != NULL) {
+            memset(node, 0, sizeof(rcpcNode));
+            node->next = proxy->freeHead;
+            node->inuse = -1;
+            proxy->freeHead = node;
+            proxy->numNodes++;
+        }
+    }
+
     proxy->initialized = true;
+    return true;
+
+    // undo partial init, nodes chained from node back to the current node
+fail:
+    while (node != NULL) {
+        latentNode = node->next;
+        _freeNode(proxy, node);
+        node = latentNode;
+    }
+    proxy->tail = NULL;
+    _freeAligned(proxy->freeMem, STATS_BLOCK(proxy->stats));
+    proxy->stats = NULL;
+    pthread_key_delete(proxy->statsKey);
+    return false;
 }
 
 void rcpcDeleteProxy(rcpcProxy *proxy) {
     rcpcNode *node, *next;
+    parkedData *pdata, *pnext;
+    rcpcSlab *slab, *snext;
     int n = 0;
 
     node = proxy->freeHead;
     while (node != NULL) {
         n++;
         next = node->next;
-        proxy->freeMem(node);
+        if (proxy->nodesPerSlab == 0)
+            _freeAligned(proxy->freeMem, node);
         node = next;
     }
     
+    for (slab = proxy->slabs; slab != NULL; slab = snext) {
+        snext = slab->next;
+        _freeAligned(proxy->freeMem, slab);
+    }
+    pthread_mutex_destroy(&proxy->arenaLock);
+    
+    for (pdata = proxy->parked; pdata != NULL; pdata = pnext) {
+        pnext = pdata->next;
+        if (pdata->freeData != NULL && pdata->data != NULL)
+            (*pdata->freeData)(pdata->data);		// accepted by try deferred delete, unreferenced now
+        proxy->freeMem(pdata);
+    }
+    
+    _deleteReclaim(proxy);
+    if (proxy->initialized)
+        _deleteStats(proxy);
     if (proxy->stats != NULL)
-        proxy->freeMem(proxy->stats);
-    proxy->freeMem(proxy);
+        _freeAligned(proxy->freeMem, STATS_BLOCK(proxy->stats));
+    _freeAligned(proxy->freeMem, proxy);
 }
 
 /*
@@ -183,11 +482,16 @@ rcpcNode* _newNode(rcpcProxy* proxy, bool alloc) {
         while (oldNum < proxy->maxNodes && !atomic_compare_exchange_strong_explicit(&proxy->numNodes, &oldNum, oldNum + 1, memory_order_relaxed, memory_order_relaxed));
         if (oldNum >= proxy->maxNodes)
             return NULL;
-        node = proxy->allocMem(sizeof(rcpcNode));
-		if (node == NULL)
+        node = _allocNode(proxy);
+		TRACE3(new_node_alloc, proxy, node, oldNum + 1);
+		if (node == NULL) {
+			atomic_fetch_sub_explicit(&proxy->numNodes, 1, memory_order_relaxed);	// give back the slot
 			return NULL;
+		}
 	}
 
+	if (node == NULL)
+		return NULL;
 	memset(node, 0, sizeof(rcpcNode));
 	node->inuse = 1;
 
@@ -214,16 +518,12 @@ void setNodeSequence(rcpcProxy* proxy, rcpcNode* node) {
 
 	atomic_store_explicit(&node->next->prevSequence, atomic_load_explicit(&node->sequence, memory_order_relaxed), memory_order_relaxed);
 
-	// adjust reference count
-	st_int_t oldCount, newCount, temp, adjust;
+	// adjust reference count by acquired references and clear guard bit, once
+	st_int_t adjust;
 
-	adjust = (node->sequence - node->prevSequence) - GUARD_BIT;
-
-	oldCount = atomic_load_explicit(&node->count, memory_order_relaxed);
-	while ((oldCount & GUARD_BIT) != 0) {
-        newCount = oldCount + adjust;
-        if (atomic_compare_exchange_strong_explicit(&node->count, &oldCount, newCount, memory_order_acq_rel, memory_order_relaxed))
-            break;
+	if (!atomic_load_explicit(&node->closed, memory_order_relaxed) && !atomic_exchange_explicit(&node->closed, true, memory_order_acq_rel)) {
+        adjust = (node->sequence - node->prevSequence) - GUARD_BIT;
+        atomic_fetch_add_explicit(&node->count, adjust, memory_order_acq_rel);
 	}
 
 	// swing tail pointer to new node if necessary
@@ -233,6 +533,8 @@ void setNodeSequence(rcpcProxy* proxy, rcpcNode* node) {
 	}
 }
 
+rcpcNode* _resolveNode(rcpcProxy* proxy, rcpcNode* node, st_int_t newSequence, int *latency);
+
 rcpcNode* rcpcGetProxyNodeReference(rcpcProxy* proxy, int *latency) {
 	rcpcNode* node;
 	st_int_t oldSequence, newSequence;
@@ -245,6 +547,30 @@ rcpcNode* rcpcGetProxyNodeReference(rcpcProxy* proxy, int *latency) {
 	}
 	while (!atomic_compare_exchange_strong_explicit(&proxy->sequence, &oldSequence, newSequence, memory_order_acq_rel, memory_order_acquire));
 
+	return _resolveNode(proxy, node, newSequence, latency);
+}
+
+/*
+ * Wait-free reference
+ * A single fetch_add of the sequence instead of the CAS loop.  The tail
+ * is loaded first so it is at or before the node covering the acquired
+ * sequence, the same window the CAS loop has.  The walk to the covering
+ * node is bounded by the latent nodes and each step is wait-free.
+ */
+rcpcNode* rcpcGetProxyNodeReferenceWF(rcpcProxy* proxy, int *latency) {
+	rcpcNode* node;
+	st_int_t newSequence;
+
+	node = atomic_load_explicit(&proxy->tail, memory_order_acquire);
+	newSequence = atomic_fetch_add_explicit(&proxy->sequence, REFERENCE, memory_order_acq_rel) + REFERENCE;
+
+	return _resolveNode(proxy, node, newSequence, latency);
+}
+
+/*
+ * Walk to node covering sequence, setting sequences of closed nodes
+ */
+rcpcNode* _resolveNode(rcpcProxy* proxy, rcpcNode* node, st_int_t newSequence, int *latency) {
 	int n = 0;
 	while (node->next != NULL) {
         //n++;
@@ -262,27 +588,199 @@ rcpcNode* rcpcGetProxyNodeReference(rcpcProxy* proxy, int *latency) {
     if (latency != NULL)
         *latency = n;
 
-    rcpcGetLocalStats(proxy)->latency[n]++;
+    stats_t *stats = rcpcGetLocalStats(proxy);
+    stats->latency[(n < stats->latencySize) ? n : stats->latencySize - 1]++;
+	TRACE3(get_ref, proxy, node, n);
     
 	return node;
 }
 
+/*
+ * Deferred reclamation
+ * Data released by the drop walk is freed inline up to the reclaim budget
+ * per drop, the rest is put on the thread's deferred free buffer and freed
+ * by later drops or rcpcReclaimPending.  If a reclaim handler is set, all
+ * released data is handed to it instead, e.g. to queue to a reclaimer
+ * thread.
+ */
+static reclaimBuffer * _getReclaimBuffer(rcpcProxy *proxy, bool alloc) {
+    reclaimBuffer *buffer = pthread_getspecific(proxy->reclaimKey);
+    
+    if (buffer == NULL && alloc) {
+        if ((buffer = proxy->allocMem(sizeof(reclaimBuffer))) == NULL)
+            return NULL;
+        memset(buffer, 0, sizeof(reclaimBuffer));
+        buffer->proxy = proxy;
+        pthread_setspecific(proxy->reclaimKey, buffer);
+    }
+    return buffer;
+}
+
+// false if the buffer or its grown ring can't be allocated
+static bool _pushReclaim(rcpcProxy *proxy, reclaimItem *item) {
+    reclaimBuffer *buffer = _getReclaimBuffer(proxy, true);
+    reclaimItem *items;
+    size_t size;
+    
+    if (buffer == NULL)
+        return false;
+    if (buffer->count == buffer->size) {		// full, grow ring
+        size = (buffer->size > 0) ? 2 * buffer->size : RECLAIM_SIZE;
+        if ((items = proxy->allocMem(size * sizeof(reclaimItem))) == NULL)
+            return false;
+        for (size_t ndx = 0; ndx < buffer->count; ndx++)
+            items[ndx] = buffer->items[(buffer->head + ndx) % buffer->size];
+        if (buffer->items != NULL)
+            proxy->freeMem(buffer->items);
+        buffer->items = items;
+        buffer->head = 0;
+        buffer->size = size;
+    }
+    
+    buffer->items[(buffer->head + buffer->count) % buffer->size] = *item;
+    buffer->count++;
+    return true;
+}
+
+static size_t _reclaimPending(reclaimBuffer *buffer, size_t max) {
+    reclaimItem item;
+    size_t n = 0;
+    
+    while (buffer->count > 0 && (max == 0 || n < max)) {
+        item = buffer->items[buffer->head];
+        buffer->head = (buffer->head + 1) % buffer->size;
+        buffer->count--;
+        if (buffer->count > 0)
+            PREFETCH(buffer->items[buffer->head].data);
+        (*item.freeData)(item.data);
+        n++;
+    }
+    rcpcGetLocalStats(buffer->proxy)->dataFrees += n;
+    return n;
+}
+
+void _freeReclaimBuffer(void *data) {
+    reclaimBuffer *buffer = (reclaimBuffer *)data;
+    
+    _reclaimPending(buffer, 0);			// data already unreferenced
+    if (buffer->items != NULL)
+        buffer->proxy->freeMem(buffer->items);
+    buffer->proxy->freeMem(buffer);
+}
+
+static void _deleteReclaim(rcpcProxy *proxy) {
+    reclaimBuffer *buffer = _getReclaimBuffer(proxy, false);
+    
+    if (buffer != NULL) {
+        pthread_setspecific(proxy->reclaimKey, NULL);
+        _freeReclaimBuffer(buffer);
+    }
+    pthread_key_delete(proxy->reclaimKey);		// other threads' pending data is not freed
+}
+
+void rcpcSetReclaimBudget(rcpcProxy *proxy, unsigned int budget) {
+    atomic_store_explicit(&proxy->reclaimBudget, budget, memory_order_relaxed);
+}
+
+void rcpcSetReclaimHandler(rcpcProxy *proxy, void (*handler)(void (*freeData)(void *), void *data, void *arg), void *arg) {
+    proxy->reclaimArg = arg;
+    atomic_store_explicit(&proxy->reclaimHandler, handler, memory_order_release);
+}
+
+size_t rcpcReclaimPending(rcpcProxy *proxy, size_t max) {
+    reclaimBuffer *buffer;
+    
+    if ((buffer = _getReclaimBuffer(proxy, false)) == NULL)
+        return 0;
+    return _reclaimPending(buffer, max);
+}
+
 void rcpcDropProxyNodeReference(rcpcProxy* proxy, rcpcNode* proxyNode) {
 	rcpcNode* node = proxyNode;
-	while (atomic_sub_fetch_explicit(&node->count, REFERENCE, memory_order_seq_cst) == 0)
+	int recycled = 0;
+	unsigned int budget = atomic_load_explicit(&proxy->reclaimBudget, memory_order_relaxed);
+	size_t spent = 0;
+	reclaimItem item;
+	reclaimBuffer *buffer;
+	void (*handler)(void (*)(void *), void *, void *);
+
+	while (atomic_fetch_sub_explicit(&node->count, REFERENCE, memory_order_seq_cst) == REFERENCE)
 	{
 		atomic_store_explicit(&proxy->freeTail, proxy->freeTail->next, memory_order_release);
 		node->inuse = -1;
 		node = node->next;
+		recycled++;
+		PREFETCH(node->next);		// next node's count, overlaps with free below
         
 		// free data queued for deferred deletion
         if (node->freeData != NULL && node->data != NULL) {
-            (*node->freeData)(node->data);
+            item.freeData = node->freeData;
+            item.data = node->data;
             node->data = NULL;
             
-            rcpcGetLocalStats(proxy)->dataFrees++;
+            if ((handler = atomic_load_explicit(&proxy->reclaimHandler, memory_order_acquire)) != NULL) {
+                (*handler)(item.freeData, item.data, proxy->reclaimArg);
+                rcpcGetLocalStats(proxy)->deferredFrees++;
+            }
+            else if (budget != 0 && spent >= budget && _pushReclaim(proxy, &item)) {
+                rcpcGetLocalStats(proxy)->deferredFrees++;
+            }
+            else {
+                (*item.freeData)(item.data);		// over budget if it couldn't be pushed
+                spent++;
+                rcpcGetLocalStats(proxy)->dataFrees++;
+            }
         }
 	}
+
+	// budget left, free data deferred by earlier drops
+	if (budget != 0 && spent < budget && (buffer = _getReclaimBuffer(proxy, false)) != NULL)
+		_reclaimPending(buffer, budget - spent);
+
+	TRACE3(drop_ref, proxy, proxyNode, recycled);
+
+	// nodes available, queue parked deferred deletes
+	if (recycled > 0 && atomic_load_explicit(&proxy->parked, memory_order_relaxed) != NULL)
+		_drainParked(proxy);
+
+	// otherwise trim free nodes owed by latency decreases, best effort
+	else if (recycled > 0 && atomic_load_explicit(&proxy->trimNodes, memory_order_relaxed) != 0)
+		rcpcTryDeleteProxyNodes(proxy, atomic_exchange_explicit(&proxy->trimNodes, 0, memory_order_relaxed));
+}
+
+/*
+ * Adaptive latency
+ * Each thread evaluates its own window of _addNode calls.  Latency is
+ * raised if more than 1/ADAPT_GROW of them failed and lowered if none
+ * did, within [minLatency, latencyCap].  When latency is lowered a free
+ * node is owed back, trimmed by the next drop that recycles nodes rather
+ * than on the _addNode path.
+ */
+void _adaptLatency(rcpcProxy *proxy, stats_t *stats, bool rc) {
+    statsBlock *block = STATS_BLOCK(stats);
+    unsigned int latency, newLatency;
+
+    block->windowTries++;
+    block->windowFails += rc ? 0 : 1;
+    if (block->windowTries < ADAPT_WINDOW)
+        return;
+
+    latency = atomic_load_explicit(&proxy->latency, memory_order_relaxed);
+    if (block->windowFails * ADAPT_GROW > block->windowTries && latency < proxy->latencyCap)
+        newLatency = latency + 1;
+    else if (block->windowFails == 0 && latency > proxy->minLatency)
+        newLatency = latency - 1;
+    else
+        newLatency = latency;
+
+    block->windowTries = 0;
+    block->windowFails = 0;
+
+    if (newLatency != latency && atomic_compare_exchange_strong_explicit(&proxy->latency, &latency, newLatency, memory_order_relaxed, memory_order_relaxed)) {
+        stats->latencyChanges++;
+        if (newLatency < latency)
+            atomic_fetch_add_explicit(&proxy->trimNodes, 1, memory_order_relaxed);
+    }
 }
 
 /*
@@ -303,7 +801,7 @@ bool _addNode(rcpcProxy* proxy, rcpcNode *refNode, int latency, rcpcNode* newNod
 
     rc = false;
     tailNode = refNode;
-    while (latency <= proxy->latency) {
+    while (latency <= atomic_load_explicit(&proxy->latency, memory_order_relaxed)) {
         newNode->qsequence = tailNode->qsequence + 1;
         next = NULL;        // assume NULL
         attempts++;
@@ -314,11 +812,15 @@ bool _addNode(rcpcProxy* proxy, rcpcNode *refNode, int latency, rcpcNode* newNod
         tailNode = next;
         latency++;
     }
+    TRACE5(add_node, proxy, newNode, rc, attempts, latency);
     
     stats_t *stats = rcpcGetLocalStats(proxy);
     stats->tries++;                         // _addNode invocations
     stats->successful += rc ? 1 : 0;
     stats->attempts += attempts;            // tail enqueue attempts
+
+    if (proxy->adaptive)
+        _adaptLatency(proxy, stats, rc);
         
     return rc;
 }
@@ -331,26 +833,138 @@ bool rcpcAddNode(rcpcProxy *proxy, rcpcNode *node) {
     return rc;
 }
 
+/*
+ * Queue node, proxy reference required
+ */
+rcpcNode* _queueNode(rcpcProxy *proxy, rcpcNode *refNode, int latency, rcpcNode *node) {
+    while (!_addNode(proxy, refNode, latency, node)) {        
+        rcpcDropProxyNodeReference(proxy, refNode);
+        refNode = rcpcGetProxyNodeReference(proxy, &latency);
+    }
+    return refNode;
+}
+
 void rcpcDeferredDelete(rcpcProxy *proxy, void (*freeData)(void *), void *data, void (*backoff)(int)) {
     rcpcNode *refNode, *node;
     int latency;
+    long start = 0;
 	int n = 0;
     
 	refNode = rcpcGetProxyNodeReference(proxy, &latency);
 	while ((node = _newNode(proxy, true)) == NULL) {
 		rcpcDropProxyNodeReference(proxy, refNode);
+		if (n == 0) {
+			start = _nanotime();
+			TRACE2(backoff, proxy, proxy->maxNodes);
+		}
 		backoff(n++);
 		refNode = rcpcGetProxyNodeReference(proxy, &latency);
 	}
     
+    if (n > 0) {
+        stats_t *stats = rcpcGetLocalStats(proxy);
+        long nanos = _nanotime() - start;
+        stats->backoffs += n;
+        stats->blockTime += nanos;
+        TRACE3(backoff_done, proxy, n, nanos);
+    }
+    
     node->freeData = freeData;
     node->data = data;
     
-    while (!_addNode(proxy, refNode, latency, node)) {        
+    refNode = _queueNode(proxy, refNode, latency, node);
+    rcpcDropProxyNodeReference(proxy, refNode);
+}
+
+/*
+ * Non-blocking deferred delete
+ * If no node is available the request is parked on the overflow list and
+ * queued when nodes are next recycled.  If the parked record can't be
+ * allocated either, it falls back to the blocking deferred delete.
+ */
+static void _yieldBackoff(int n) {
+    (void)n;							// backoff signature, count unused
+    sched_yield();
+}
+
+void _pushParked(rcpcProxy *proxy, parkedData *pdata) {
+    pdata->next = atomic_load_explicit(&proxy->parked, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&proxy->parked, &pdata->next, pdata, memory_order_release, memory_order_relaxed));
+}
+
+bool rcpcTryDeferredDelete(rcpcProxy *proxy, void (*freeData)(void *), void *data) {
+    rcpcNode *refNode, *node;
+    parkedData *pdata;
+    int latency;
+    
+	refNode = rcpcGetProxyNodeReference(proxy, &latency);
+    if ((node = _newNode(proxy, true)) != NULL) {
+        node->freeData = freeData;
+        node->data = data;
+        refNode = _queueNode(proxy, refNode, latency, node);
         rcpcDropProxyNodeReference(proxy, refNode);
-        refNode = rcpcGetProxyNodeReference(proxy, &latency);
+        return true;
     }
     rcpcDropProxyNodeReference(proxy, refNode);
+    
+    if ((pdata = proxy->allocMem(sizeof(parkedData))) == NULL) {
+        rcpcDeferredDelete(proxy, freeData, data, &_yieldBackoff);	// can't park, block
+        return true;
+    }
+    pdata->freeData = freeData;
+    pdata->data = data;
+    pdata->parkTime = _nanotime();
+    _pushParked(proxy, pdata);
+    
+    rcpcGetLocalStats(proxy)->parks++;
+    return false;
+}
+
+unsigned int _drainParked(rcpcProxy *proxy) {
+    parkedData *pdata, *next;
+    rcpcNode *refNode, *node;
+    int latency;
+    unsigned int n = 0;
+    bool exhausted;
+    
+    do {
+        if (atomic_exchange_explicit(&proxy->draining, true, memory_order_acquire))
+            return n;		// drain in progress
+        
+        pdata = atomic_exchange_explicit(&proxy->parked, NULL, memory_order_acquire);
+        refNode = rcpcGetProxyNodeReference(proxy, &latency);
+        while (pdata != NULL && (node = _newNode(proxy, true)) != NULL) {
+            next = pdata->next;
+            node->freeData = pdata->freeData;
+            node->data = pdata->data;
+            rcpcGetLocalStats(proxy)->parkTime += _nanotime() - pdata->parkTime;
+            refNode = _queueNode(proxy, refNode, latency, node);
+            proxy->freeMem(pdata);
+            pdata = next;
+            n++;
+        }
+        rcpcDropProxyNodeReference(proxy, refNode);
+        
+        // still no nodes, repark
+        exhausted = (pdata != NULL);
+        while (pdata != NULL) {
+            next = pdata->next;
+            _pushParked(proxy, pdata);
+            pdata = next;
+        }
+        
+        atomic_store_explicit(&proxy->draining, false, memory_order_release);
+        
+        // parked while draining and the concurrent drain attempt returned,
+        // drain again unless out of nodes (a later recycling drop drains)
+    }
+    while (!exhausted && atomic_load_explicit(&proxy->parked, memory_order_acquire) != NULL);
+    
+    return n;
+}
+
+unsigned int rcpcDrainParked(rcpcProxy *proxy) {
+    return _drainParked(proxy);
 }
 
 unsigned int rcpcTryDeleteProxyNodes(rcpcProxy *proxy, unsigned int count) {
@@ -361,8 +975,8 @@ unsigned int rcpcTryDeleteProxyNodes(rcpcProxy *proxy, unsigned int count) {
         rcpcNode *node = rcpcNewNode(proxy, false);
         if (node == NULL)
             break;
-        proxy->freeMem(node);
-        current = atomic_sub_fetch_explicit(&proxy->numNodes, 1, memory_order_relaxed);
+        _freeNode(proxy, node);
+        current = atomic_fetch_sub_explicit(&proxy->numNodes, 1, memory_order_relaxed) - 1;
     }
     return n;
 }
@@ -372,13 +986,21 @@ void rcpcSetLatency(rcpcProxy *proxy, unsigned int latency) {
         proxy->latency = latency;    
 }
 
+void rcpcSetAdaptiveLatency(rcpcProxy *proxy, unsigned int minLatency, unsigned int maxLatency) {
+    if (!proxy->initialized && minLatency <= maxLatency) {
+        proxy->adaptive = true;
+        proxy->minLatency = minLatency;
+        proxy->latencyCap = maxLatency;
+    }
+}
+
 void rcpcSetMaxNodes(rcpcProxy *proxy, unsigned int maxNodes) {
     if (maxNodes > 1)
         atomic_store_explicit(&proxy->maxNodes, maxNodes, memory_order_relaxed);
 }
 
 unsigned int rcpcGetLatency(rcpcProxy *proxy) {
-    return proxy->latency;
+    return atomic_load_explicit(&proxy->latency, memory_order_relaxed);
 }
 
 unsigned int rcpcGetMaxLatency(rcpcProxy *proxy) {
@@ -394,38 +1016,127 @@ unsigned int stpcGetNodeCount(rcpcProxy *proxy) {
 }
 
 stats_t * _allocStats(rcpcProxy *proxy) {    
-    size_t sz = sizeof(stats_t) + (proxy->maxLatency + 1) * sizeof(*((stats_t *)0)->latency);
-    stats_t *stats = (stats_t *)proxy->allocMem(sz);
-    memset(stats, 0, sz);
+    size_t sz = sizeof(statsBlock) + (proxy->maxLatency + 1) * sizeof(*((stats_t *)0)->latency);
+    statsBlock *block = (statsBlock *)_allocAligned(proxy->allocMem, sz);	// per thread, own line
+    if (block == NULL)
+        return NULL;
+    memset(block, 0, sz);
+    stats_t *stats = &block->stats;
     stats->proxy = proxy;
     stats->latencySize = proxy->maxLatency + 1;
     return stats;
 }
 
+/*
+ * Stats registry
+ * Per thread stats blocks are kept on a per proxy list for the life of
+ * the proxy.  A block released at thread exit is reused by the next new
+ * thread, so its counts stay in the totals.  The current thread's block
+ * for the last proxy used is cached in a __thread variable, keyed by
+ * proxy id, to avoid the pthread_getspecific lookup.
+ */
+static __thread struct {
+    unsigned long   id;
+    stats_t *       stats;
+} _statsCache;
+
+static unsigned long _proxyIds = 0;         // proxy id generator
+
+stats_t * _registerStats(rcpcProxy *proxy) {
+    statsBlock *block;
+    stats_t *stats;
+    int inuse;
+    
+    for (block = atomic_load_explicit(&proxy->registry, memory_order_acquire); block != NULL; block = block->next) {
+        inuse = 0;
+        if (atomic_load_explicit(&block->inuse, memory_order_relaxed) == 0 && atomic_compare_exchange_strong_explicit(&block->inuse, &inuse, 1, memory_order_acquire, memory_order_relaxed))
+            return &block->stats;
+    }
+    
+    stats = _allocStats(proxy);
+    if (stats == NULL)
+        return proxy->stats;        // no block, count into the snapshot block, counts may be lost
+    block = STATS_BLOCK(stats);
+    block->inuse = 1;
+    block->next = atomic_load_explicit(&proxy->registry, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&proxy->registry, &block->next, block, memory_order_release, memory_order_relaxed));
+    
+    return stats;
+}
+
 void _freeStats(void *data) {
     stats_t *stats = (stats_t *)data;
-    rcpcProxy *proxy = stats->proxy;
-    stats_t *pstats = proxy->stats;
-    atomic_add_fetch_explicit(&pstats->attempts, stats->attempts, memory_order_relaxed);
-    atomic_add_fetch_explicit(&pstats->dataFrees, stats->dataFrees, memory_order_relaxed);
-    atomic_add_fetch_explicit(&pstats->successful, stats->successful, memory_order_relaxed);
-    atomic_add_fetch_explicit(&pstats->tries, stats->tries, memory_order_relaxed);
-    atomic_add_fetch_explicit(&pstats->reuse, stats->reuse, memory_order_relaxed);
-    for (int j = 0; j <= proxy->maxLatency; j++)
-        atomic_add_fetch_explicit(&pstats->latency[j], stats->latency[j], memory_order_relaxed);
-    free(data);
+    
+    if (_statsCache.stats == stats)
+        _statsCache.id = 0;
+    atomic_store_explicit(&STATS_BLOCK(stats)->inuse, 0, memory_order_release);		// release for reuse
+}
+
+void _deleteStats(rcpcProxy *proxy) {
+    statsBlock *block, *next;
+    
+    pthread_key_delete(proxy->statsKey);
+    for (block = proxy->registry; block != NULL; block = next) {
+        next = block->next;
+        _freeAligned(proxy->freeMem, block);
+    }
+    proxy->registry = NULL;
+    _statsCache.id = 0;
 }
 
 stats_t * rcpcGetLocalStats(rcpcProxy *proxy) {
+    if (_statsCache.id == proxy->id)
+        return _statsCache.stats;
+    
     stats_t *stats = pthread_getspecific(proxy->statsKey);
     if (stats == NULL) {
-        stats = _allocStats(proxy);
-        pthread_setspecific(proxy->statsKey, stats);        
+        stats = _registerStats(proxy);
+        if (stats != proxy->stats)      // snapshot block is not in the registry
+            pthread_setspecific(proxy->statsKey, stats);        
     }
+    
+    _statsCache.id = proxy->id;
+    _statsCache.stats = stats;
     return stats;
 }
 
+/*
+ * Sum live and exited threads' stats without stopping them
+ * out->latencySize is the capacity of out->latency[] on entry and the
+ * number of histogram entries filled in on return.
+ */
+void rcpcGetStatsSnapshot(rcpcProxy *proxy, stats_t *out) {
+    statsBlock *block;
+    stats_t *stats;
+    long latencySize = out->latencySize;       // capacity of out->latency[]
+
+    if (latencySize < 0)
+        latencySize = 0;
+    if (latencySize > proxy->maxLatency + 1)
+        latencySize = proxy->maxLatency + 1;
+    memset(out, 0, sizeof(stats_t) + latencySize * sizeof(out->latency[0]));
+    out->proxy = proxy;
+    out->latencySize = latencySize;
+    for (block = atomic_load_explicit(&proxy->registry, memory_order_acquire); block != NULL; block = block->next) {
+        stats = &block->stats;
+        out->tries += atomic_load_explicit(&stats->tries, memory_order_relaxed);
+        out->successful += atomic_load_explicit(&stats->successful, memory_order_relaxed);
+        out->attempts += atomic_load_explicit(&stats->attempts, memory_order_relaxed);
+        out->reuse += atomic_load_explicit(&stats->reuse, memory_order_relaxed);
+        out->dataFrees += atomic_load_explicit(&stats->dataFrees, memory_order_relaxed);
+        out->parks += atomic_load_explicit(&stats->parks, memory_order_relaxed);
+        out->backoffs += atomic_load_explicit(&stats->backoffs, memory_order_relaxed);
+        out->blockTime += atomic_load_explicit(&stats->blockTime, memory_order_relaxed);
+        out->parkTime += atomic_load_explicit(&stats->parkTime, memory_order_relaxed);
+        out->deferredFrees += atomic_load_explicit(&stats->deferredFrees, memory_order_relaxed);
+        out->latencyChanges += atomic_load_explicit(&stats->latencyChanges, memory_order_relaxed);
+        for (int j = 0; j < latencySize; j++)
+            out->latency[j] += atomic_load_explicit(&stats->latency[j], memory_order_relaxed);
+    }
+}
+
 stats_t * rcpcGetStats(rcpcProxy *proxy) {
+    rcpcGetStatsSnapshot(proxy, proxy->stats);
     return proxy->stats;
 }
 
@@ -17,14 +17,25 @@
 #ifndef STPDR_H_
 #define STPDR_H_
 
+#ifndef __cplusplus
 #include <stdatomic.h>
+#endif
 #include <stdbool.h>
 #include <stdint.h>
 #include <pthread.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct _rcpcNode stpcNode;
 typedef struct _rcpcProxy rcpcProxy;
 
+/*
+ * Counts are bumped with plain increments by the owning thread and summed
+ * with relaxed loads, so a snapshot of running threads is approximate.
+ * Aligned long updates don't tear on the supported 64 bit targets.
+ */
 typedef struct _stats_t {
     rcpcProxy *proxy;
     long    tries;          // # calls to _addNode
@@ -32,18 +43,30 @@ typedef struct _stats_t {
     long    attempts;       // # attempts to queue node onto tail node
     long    reuse;          // # node reuse/recyling
     long    dataFrees;      // # dataFrees
+    long    parks;          // # deferred deletes parked, no nodes available
+    long    backoffs;       // # backoff calls, no nodes available
+    long    blockTime;      // time blocked in backoff (nsecs)
+    long    parkTime;       // time parked deletes waited for a node (nsecs)
+    long    deferredFrees;  // # dataFrees deferred past reclaim budget or handed off
+    long    latencyChanges; // # adaptive latency adjustments
     long    latencySize;    // size of latency[]
     long    latency[];      // getProxyNodeReference latency distribution
 } stats_t;
 
 extern stats_t * rcpcGetLocalStats(rcpcProxy *proxy);
-extern stats_t * rcpcGetStats(rcpcProxy *proxy);
+extern stats_t * rcpcGetStats(rcpcProxy *proxy);        // snapshot into proxy's stats
+// set out->latencySize to the capacity of out->latency[] before the call,
+// it is set to the entries filled in, at most rcpcGetMaxLatency(proxy) + 1
+extern void rcpcGetStatsSnapshot(rcpcProxy *proxy, stats_t *out);
 
 extern rcpcProxy *rcpcNewProxy();
 extern rcpcProxy * rcpcNewProxyM(void *(allocMem)(size_t), void (*freeMem)(void *));
+extern rcpcProxy *rcpcNewProxyArena(unsigned int nodesPerSlab);     // nodes carved from slabs
+extern rcpcProxy *rcpcNewProxyArenaM(unsigned int nodesPerSlab, void *(allocMem)(size_t), void (*freeMem)(void *));
 extern void rcpcSetLatency(rcpcProxy *proxy, unsigned int latency);   // set before initProxy
+extern void rcpcSetAdaptiveLatency(rcpcProxy *proxy, unsigned int minLatency, unsigned int maxLatency);   // set before initProxy
 extern void rcpcSetMaxNodes(rcpcProxy *proxy, unsigned int maxNodes); // set before initProxy
-extern void rcpcInitProxy(rcpcProxy *proxy);
+extern bool rcpcInitProxy(rcpcProxy *proxy);     // false if node or stats allocation failed
 extern void rcpcDeleteProxy(rcpcProxy *proxy);
 
 extern unsigned int rcpcGetLatency(rcpcProxy *proxy);
@@ -52,9 +75,24 @@ extern unsigned int rcpcGetMaxNodes(rcpcProxy *proxy);
 extern unsigned int stpcGetNodeCount(rcpcProxy *proxy);
 
 extern stpcNode *rcpcGetProxyNodeReference(rcpcProxy *proxy, int *latency);
+extern stpcNode *rcpcGetProxyNodeReferenceWF(rcpcProxy *proxy, int *latency);    // wait-free
 extern void rcpcDropProxyNodeReference(rcpcProxy* proxy, stpcNode* node);
 extern void rcpcDeferredDelete(rcpcProxy *proxy, void (*freeData)(void *), void *data, void (*backoff)(int));
 
+// non-blocking, returns false if parked until nodes are recycled, blocks
+// as rcpcDeferredDelete if the parked record can't be allocated
+extern bool rcpcTryDeferredDelete(rcpcProxy *proxy, void (*freeData)(void *), void *data);
+extern unsigned int rcpcDrainParked(rcpcProxy *proxy);
+
+// deferred reclamation, limit frees done inline by a releasing reader
+extern void rcpcSetReclaimBudget(rcpcProxy *proxy, unsigned int budget);	// 0 unlimited (default)
+extern void rcpcSetReclaimHandler(rcpcProxy *proxy, void (*handler)(void (*freeData)(void *), void *data, void *arg), void *arg);
+extern size_t rcpcReclaimPending(rcpcProxy *proxy, size_t max);		// free thread's deferred data, 0 all
+
 extern unsigned int rcpcTryDeleteProxyNodes(rcpcProxy *proxy, unsigned int count);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* STPDR_H_ */
@@ -13,23 +13,78 @@
    See the License for the specific language governing permissions and
    limitations under the License.
  */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "stpc.h"
 
 typedef long st_int_t;
 
+/*
+ * Cache line layout
+ * With STPC_PADDED (default) independently written proxy fields are put on
+ * separate cache lines and nodes are allocated cache line aligned.
+ * Define STPC_PADDED to 0 for the compact layout, STPC_CACHE_LINE for
+ * 128 byte lines.
+ */
+#ifndef STPC_CACHE_LINE
+#define STPC_CACHE_LINE 64
+#endif
+#ifndef STPC_PADDED
+#define STPC_PADDED 1
+#endif
+
+#if STPC_PADDED
+#define CACHE_ALIGNED _Alignas(STPC_CACHE_LINE)
+#else
+#define CACHE_ALIGNED
+#endif
+
 typedef struct _stpcNode {
-    struct _stpcNode*	next;				// subsequent node
+    CACHE_ALIGNED struct _stpcNode*	next;	// subsequent node
     st_int_t		count;					// reference count
     void            (*freeData)(void *);    // user supplied free data function
     void*			data;
+    void**			dataVec;				// batched data, freed with data vector
+    size_t			dataCount;				// # of batched data
+    struct _stpcProxy*	proxy;			// owning proxy (shard)
 } stpcNode;
 
+/*
+ * deferred delete parked on overflow list when no nodes available
+ */
+typedef struct _parkedData {
+	struct _parkedData*	next;
+	void            (*freeData)(void *);
+	void*			data;
+	long			parkTime;		// time parked (nsecs)
+} parkedData;
+
+/*
+ * per thread stats block, registry links around the public counts
+ */
+typedef struct _statsBlock {
+	struct _statsBlock*	next;		// proxy stats registry
+	int				inuse;			// registry block owned by a thread
+	stats_t			stats;
+} statsBlock;
+
+#define STATS_BLOCK(s) ((statsBlock *)((char *)(s) - offsetof(statsBlock, stats)))
+
+/*
+ * arena slab, nodes follow header
+ */
+typedef struct _stpcSlab {
+	CACHE_ALIGNED struct _stpcSlab*	next;
+} stpcSlab;
+
 typedef union {
 #if __SIZEOF_LONG__ == 8
 	__int128		ival;
@@ -43,20 +98,123 @@ typedef union {
 } sequencedPtr;
 
 typedef struct _stpcProxy {
-	sequencedPtr	tail;
-    stpcNode*       freeTail;		// referenced node head
-    sequencedPtr	freeHead;		// free unreferenced nodes if != head
+	CACHE_ALIGNED sequencedPtr	tail;
+    CACHE_ALIGNED stpcNode*     freeTail;		// referenced node head
+    CACHE_ALIGNED sequencedPtr	freeHead;		// free unreferenced nodes if != head
 
-    unsigned int	maxNodes;		// maximum nodes
+    CACHE_ALIGNED unsigned int	maxNodes;		// maximum nodes
 	void			*(*allocMem)(size_t);	// allocate memory function (default malloc)
 	void            (*freeMem)(void *);    // free memory function (default free)
     //
-    unsigned int	numNodes;		// current number of allocated nodes    
+    CACHE_ALIGNED unsigned int	numNodes;		// current number of allocated nodes    
+    //
+    CACHE_ALIGNED pthread_key_t statsKey;
+	struct _stats_t	stats;			// last snapshot
+    unsigned long	id;				// unique proxy id
+    statsBlock*		registry;		// per thread stats blocks
+    //
+    pthread_key_t   retireKey;		// thread local retire buffer
+    unsigned int	retireThreshold;	// retire buffer flush threshold
+    //
+    pthread_key_t   reclaimKey;		// thread local deferred free buffer
+    unsigned int	reclaimBudget;	// max data freed inline per drop, 0 unlimited
+    void			(*reclaimHandler)(void (*)(void *), void *, void *);	// hand off freed data if set
+    void*			reclaimArg;
     //
-    pthread_key_t   statsKey;
-	struct _stats_t	stats;
+    CACHE_ALIGNED parkedData*	parked;			// overflow list, parked deferred deletes
+    bool			draining;		// overflow list being drained
+    //
+    CACHE_ALIGNED pthread_mutex_t	arenaLock;
+    unsigned int	nodesPerSlab;	// arena mode if != 0
+    stpcSlab*		slabs;			// allocated slabs
+    stpcNode*		spareNodes;		// arena nodes not in use by proxy
+    //
+    unsigned int	nshards;		// # of shards, 0 if not sharded
+    struct _stpcProxy	**shards;	// shard proxies
+    struct _stpcProxy	*parent;	// sharded proxy if shard
 } stpcProxy;
 
+/*
+ * data deferred on every shard of a sharded proxy, freed by the last shard
+ */
+typedef struct _shardedData {
+	long			count;			// # shards still holding data
+	void            (*freeData)(void *);
+	void*			data;
+	void**			dataVec;		// or batched data
+	size_t			dataCount;
+	stpcProxy*		proxy;			// sharded proxy
+} shardedData;
+
+/*
+ * thread local retire buffer, handed off to a node when flushed
+ */
+typedef struct _retireBuffer {
+	stpcProxy*		proxy;
+	void            (*freeData)(void *);
+	void**			dataVec;
+	size_t			dataCount;
+	size_t			dataSize;
+} retireBuffer;
+
+#define RETIRE_THRESHOLD 64
+
+/*
+ * data released by the drop walk, deferred past the reclaim budget
+ */
+typedef struct _reclaimItem {
+	void            (*freeData)(void *);
+	void*			data;
+	void**			dataVec;		// or batched data
+	size_t			dataCount;
+} reclaimItem;
+
+/*
+ * thread local deferred free buffer, ring of reclaim items
+ */
+typedef struct _reclaimBuffer {
+	stpcProxy*		proxy;
+	reclaimItem*	items;
+	size_t			head;
+	size_t			count;
+	size_t			size;
+} reclaimBuffer;
+
+#define RECLAIM_SIZE 64
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p)
+#endif
+
+/*
+ * USDT tracepoints, provider stpc.  A nop until a tracer attaches, e.g.
+ *   bpftrace -e 'usdt:./app:stpc:get_ref { @r = hist(arg2); }'
+ * Built in if <sys/sdt.h> is available unless STPC_NOTRACE is defined.
+ *
+ *   get_ref(proxy, node, retries)          tail reference CAS retries
+ *   drop_ref(proxy, node)
+ *   queue_node(proxy, node, attempts)      tail enqueue attempts
+ *   new_node_alloc(proxy, node, numNodes)  free list empty, allocMem fallback
+ *   backoff(proxy, maxNodes)               deferred delete blocked on maxNodes
+ *   backoff_done(proxy, backoffs, nanos)
+ */
+#if !defined(STPC_NOTRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define STPC_TRACE 1
+#endif
+#endif
+
+#ifdef STPC_TRACE
+#define TRACE2(name, a, b)		DTRACE_PROBE2(stpc, name, a, b)
+#define TRACE3(name, a, b, c)	DTRACE_PROBE3(stpc, name, a, b, c)
+#else
+#define TRACE2(name, a, b)
+#define TRACE3(name, a, b, c)
+#endif
+
 
 
 #define REFERENCE 0x2
@@ -67,29 +225,136 @@ typedef struct _stpcProxy {
 stats_t * _allocStats(stpcProxy *proxy);
 stats_t * stpcGetLocalStats(stpcProxy *proxy);
 void _freeStats(void *data);
+void _freeRetireBuffer(void *data);
+static void _yieldBackoff(int n);
+void _freeReclaimBuffer(void *data);
+void _freeShardedData(void *arg);
+void _deleteStats(stpcProxy *proxy);
+static unsigned long _proxyIds;
 
-stpcProxy * stpcNewProxyM(void *(allocMem)(size_t), void (*freeMem)(void *)) {
-    // allocate current node
+/*
+ * Cache line aligned allocation through allocMem
+ */
+static void * _allocAligned(void *(allocMem)(size_t), size_t sz) {
+#if STPC_PADDED
+	char *mem = allocMem(sz + STPC_CACHE_LINE + sizeof(void *));
+	if (mem == NULL)
+		return NULL;
+	char *ptr = (char *)(((uintptr_t)mem + sizeof(void *) + STPC_CACHE_LINE - 1) & ~(uintptr_t)(STPC_CACHE_LINE - 1));
+	((void **)ptr)[-1] = mem;
+	return ptr;
+#else
+	return allocMem(sz);
+#endif
+}
 
-	stpcNode* node = malloc(sizeof(stpcNode));
-	memset(node, 0, sizeof(stpcNode));
+static void _freeAligned(void (*freeMem)(void *), void *ptr) {
+#if STPC_PADDED
+	freeMem(((void **)ptr)[-1]);
+#else
+	freeMem(ptr);
+#endif
+}
 
-	node->next = NULL;
-	node->count = GUARD_BIT + REFERENCE;		// refcount initially one
+unsigned int _drainParked(stpcProxy *proxy);
+static void _deleteReclaim(stpcProxy *proxy);
+static void _deleteRetire(stpcProxy *proxy);
 
-	
+/*
+ * Arena node store
+ * Nodes are carved out of cache line aligned slabs of nodesPerSlab nodes
+ * and returned to the arena instead of being freed.  Slabs are freed when
+ * the proxy is deleted.  Only used when the free list is empty.
+ */
+stpcNode* _arenaNode(stpcProxy *proxy) {
+	stpcNode *node;
+	stpcSlab *slab;
+
+	pthread_mutex_lock(&proxy->arenaLock);
+	if (proxy->spareNodes == NULL) {
+		slab = _allocAligned(proxy->allocMem, sizeof(stpcSlab) + proxy->nodesPerSlab * sizeof(stpcNode));
+		if (slab != NULL) {
+			slab->next = proxy->slabs;
+			proxy->slabs = slab;
+
+			node = (stpcNode *)(slab + 1);
+			for (unsigned int ndx = 0; ndx < proxy->nodesPerSlab; ndx++) {
+				node[ndx].next = proxy->spareNodes;
+				proxy->spareNodes = &node[ndx];
+			}
+		}
+	}
+
+	if ((node = proxy->spareNodes) != NULL)
+		proxy->spareNodes = node->next;
+	pthread_mutex_unlock(&proxy->arenaLock);
+
+	return node;
+}
+
+static stpcNode* _allocNode(stpcProxy *proxy) {
+	if (proxy->nodesPerSlab != 0)
+		return _arenaNode(proxy);
+	else
+		return _allocAligned(proxy->allocMem, sizeof(stpcNode));
+}
+
+static void _freeNode(stpcProxy *proxy, stpcNode *node) {
+	if (proxy->nodesPerSlab != 0) {
+		pthread_mutex_lock(&proxy->arenaLock);
+		node->next = proxy->spareNodes;
+		proxy->spareNodes = node;
+		pthread_mutex_unlock(&proxy->arenaLock);
+	}
+	else
+		_freeAligned(proxy->freeMem, node);
+}
+
+static long _nanotime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+stpcProxy * _newProxy(void *(allocMem)(size_t), void (*freeMem)(void *), stpcProxy *parent, unsigned int nodesPerSlab) {
 	// allocate proxy object
 
-	stpcProxy* proxy = allocMem(sizeof(stpcProxy));
+	stpcProxy* proxy = _allocAligned(allocMem, sizeof(stpcProxy));
+	if (proxy == NULL)
+		return NULL;
 	memset(proxy, 0, sizeof(stpcProxy));
 
+	proxy->allocMem = allocMem;
+	proxy->freeMem = freeMem;
+	proxy->nodesPerSlab = nodesPerSlab;
+	pthread_mutex_init(&proxy->arenaLock, NULL);
+
+    // allocate current node, a failed arena slab leaves no slabs to free
+
+	stpcNode* node = _allocNode(proxy);
+	if (node == NULL) {
+		pthread_mutex_destroy(&proxy->arenaLock);
+		_freeAligned(freeMem, proxy);
+		return NULL;
+	}
+	memset(node, 0, sizeof(stpcNode));
+
+	node->next = NULL;
+	node->count = GUARD_BIT + REFERENCE;		// refcount initially one
+	node->proxy = proxy;
+
 	proxy->maxNodes = UINT32_MAX;
     
 	proxy->numNodes = 1;
-	proxy->allocMem = allocMem;
-	proxy->freeMem = freeMem;
+	proxy->parent = parent;
         
-    pthread_key_create(&proxy->statsKey, &_freeStats);
+    if (parent == NULL) {
+        proxy->id = atomic_fetch_add_explicit(&_proxyIds, 1, memory_order_relaxed) + 1;
+        pthread_key_create(&proxy->statsKey, &_freeStats);	// shards use parent's stats
+        pthread_key_create(&proxy->retireKey, &_freeRetireBuffer);
+        proxy->retireThreshold = RETIRE_THRESHOLD;
+        pthread_key_create(&proxy->reclaimKey, &_freeReclaimBuffer);
+    }
     
 	proxy->tail.ptr = node;
 	proxy->tail.sequence = 0;
@@ -100,23 +365,168 @@ stpcProxy * stpcNewProxyM(void *(allocMem)(size_t), void (*freeMem)(void *)) {
 	return proxy;
 }
 
+stpcProxy * stpcNewProxyM(void *(allocMem)(size_t), void (*freeMem)(void *)) {
+	return _newProxy(allocMem, freeMem, NULL, 0);
+}
+
 stpcProxy *stpcNewProxy() {
 	return stpcNewProxyM(malloc, free);
 }
 
+/*
+ * Arena proxy
+ * Nodes come from slabs of nodesPerSlab nodes.  If maxNodes is bounded,
+ * all maxNodes nodes are preallocated onto the free list.
+ */
+stpcProxy * stpcNewProxyArenaM(unsigned int nodesPerSlab, unsigned int maxNodes, void *(allocMem)(size_t), void (*freeMem)(void *)) {
+	stpcProxy *proxy;
+	stpcNode *node;
+
+	if (nodesPerSlab == 0)
+		nodesPerSlab = 1;
+
+	proxy = _newProxy(allocMem, freeMem, NULL, nodesPerSlab);
+	if (proxy == NULL)
+		return NULL;
+	stpcSetMaxNodes(proxy, maxNodes);
+
+	if (proxy->maxNodes == UINT32_MAX)
+		return proxy;
+
+	// preallocate in front of free list head, on arena exhaustion the
+	// rest are allocated on demand as in the non-arena path
+	while (proxy->numNodes < proxy->maxNodes && (node = _arenaNode(proxy)) != NULL) {
+		memset(node, 0, sizeof(stpcNode));
+		node->next = proxy->freeHead.ptr;
+		proxy->freeHead.ptr = node;
+		proxy->numNodes++;
+	}
+
+	return proxy;
+}
+
+stpcProxy *stpcNewProxyArena(unsigned int nodesPerSlab, unsigned int maxNodes) {
+	return stpcNewProxyArenaM(nodesPerSlab, maxNodes, malloc, free);
+}
+
+/*
+ * Sharded proxy
+ * Each shard is a proxy with its own tail.  Readers reference the shard
+ * for their current cpu.  Deferred deletes are queued on every shard and
+ * the data freed when the last shard releases it.
+ */
+stpcProxy * stpcNewShardedProxyM(unsigned int nshards, void *(allocMem)(size_t), void (*freeMem)(void *)) {
+	if (nshards <= 1)
+		return stpcNewProxyM(allocMem, freeMem);
+
+	stpcProxy* proxy = _allocAligned(allocMem, sizeof(stpcProxy));
+	if (proxy == NULL)
+		return NULL;
+	memset(proxy, 0, sizeof(stpcProxy));
+
+	proxy->maxNodes = UINT32_MAX;
+	proxy->allocMem = allocMem;
+	proxy->freeMem = freeMem;
+
+    proxy->id = atomic_fetch_add_explicit(&_proxyIds, 1, memory_order_relaxed) + 1;
+    pthread_key_create(&proxy->statsKey, &_freeStats);
+    pthread_key_create(&proxy->retireKey, &_freeRetireBuffer);
+    proxy->retireThreshold = RETIRE_THRESHOLD;
+    pthread_key_create(&proxy->reclaimKey, &_freeReclaimBuffer);
+
+	proxy->shards = allocMem(nshards * sizeof(stpcProxy *));
+	if (proxy->shards == NULL)
+		goto fail;
+	for (unsigned int ndx = 0; ndx < nshards; ndx++) {
+		if ((proxy->shards[ndx] = _newProxy(allocMem, freeMem, proxy, 0)) == NULL) {
+			while (ndx > 0)
+				stpcDeleteProxy(proxy->shards[--ndx]);
+			freeMem(proxy->shards);
+			goto fail;
+		}
+	}
+	proxy->nshards = nshards;
+
+	return proxy;
+
+	// no shards left, delete the root's keys
+fail:
+	_deleteStats(proxy);
+	_deleteReclaim(proxy);
+	_deleteRetire(proxy);
+	_freeAligned(freeMem, proxy);
+	return NULL;
+}
+
+stpcProxy *stpcNewShardedProxy(unsigned int nshards) {
+	return stpcNewShardedProxyM(nshards, malloc, free);
+}
+
+unsigned int stpcGetShardCount(stpcProxy *proxy) {
+	return (proxy->nshards > 0) ? proxy->nshards : 1;
+}
+
+static inline stpcProxy * _currentShard(stpcProxy *proxy) {
+	unsigned int cpu;
+	int rc;
+
+	if (proxy->nshards == 0)
+		return proxy;
+
+	if ((rc = sched_getcpu()) >= 0)
+		cpu = rc;
+	else
+		cpu = (unsigned int)(((uintptr_t)pthread_self()) >> 12);
+
+	return proxy->shards[cpu % proxy->nshards];
+}
+
 int stpcDeleteProxy(stpcProxy *proxy) {
     stpcNode *node, *next;
+    parkedData *pdata, *pnext;
+    stpcSlab *slab, *snext;
     int n = 0;
 
+    if (proxy->nshards > 0) {
+        for (unsigned int ndx = 0; ndx < proxy->nshards; ndx++)
+            n += stpcDeleteProxy(proxy->shards[ndx]);
+        _deleteStats(proxy);
+        _deleteReclaim(proxy);
+        _deleteRetire(proxy);
+        proxy->freeMem(proxy->shards);
+        _freeAligned(proxy->freeMem, proxy);
+        return n;
+    }
+
     node = proxy->freeHead.ptr;
     while (node != NULL) {
         n++;
         next = node->next;
-        proxy->freeMem(node);
+        if (proxy->nodesPerSlab == 0)
+            _freeAligned(proxy->freeMem, node);
         node = next;
     }
     
-    proxy->freeMem(proxy);
+    for (slab = proxy->slabs; slab != NULL; slab = snext) {
+        snext = slab->next;
+        _freeAligned(proxy->freeMem, slab);
+    }
+    pthread_mutex_destroy(&proxy->arenaLock);
+    
+    if (proxy->parent == NULL) {
+        _deleteStats(proxy);
+        _deleteReclaim(proxy);
+        _deleteRetire(proxy);
+    }
+    
+    for (pdata = proxy->parked; pdata != NULL; pdata = pnext) {
+        pnext = pdata->next;
+        if (pdata->freeData != NULL && pdata->data != NULL)
+            (*pdata->freeData)(pdata->data);		// accepted by try deferred delete, unreferenced now
+        proxy->freeMem(pdata);
+    }
+    
+    _freeAligned(proxy->freeMem, proxy);
 	
 	return n;	// # of nodes allocated
 }
@@ -135,7 +545,7 @@ stpcNode* _newNode(stpcProxy* proxy, bool alloc) {
 		newFree.sequence = oldFree.sequence + 1;
         if (atomic_compare_exchange_strong_explicit(&proxy->freeHead.ival, &oldFree.ival, newFree.ival, memory_order_acq_rel, memory_order_acquire)) {
             node = oldFree.ptr;
-            stpcGetLocalStats(proxy)->reuse++;
+            stpcGetLocalStats(proxy)->reuse++;	// shard's stats are the parent's
             break;
         }
 	}
@@ -145,11 +555,16 @@ stpcNode* _newNode(stpcProxy* proxy, bool alloc) {
         while (oldNum < proxy->maxNodes && !atomic_compare_exchange_strong_explicit(&proxy->numNodes, &oldNum, oldNum + 1, memory_order_relaxed, memory_order_relaxed));
         if (oldNum >= proxy->maxNodes)
             return NULL;
-        node = proxy->allocMem(sizeof(stpcNode));
-		if (node == NULL)
+        node = _allocNode(proxy);
+		TRACE3(new_node_alloc, proxy, node, oldNum + 1);
+		if (node == NULL) {
+			atomic_fetch_sub_explicit(&proxy->numNodes, 1, memory_order_relaxed);	// give back the slot
 			return NULL;
+		}
 	}
 
+	if (node == NULL)
+		return NULL;
 	memset(node, 0, sizeof(stpcNode));
 
 	return node;
@@ -158,43 +573,213 @@ stpcNode* _newNode(stpcProxy* proxy, bool alloc) {
 stpcNode* stpcGetProxyNodeReference(stpcProxy* proxy) {
 	sequencedPtr oldTail;
 	sequencedPtr newTail;
+	int retries = -1;
 	
+	proxy = _currentShard(proxy);
 	oldTail.ival = atomic_load_explicit(&proxy->tail.ival, memory_order_relaxed);
 	do {
+		retries++;
 		newTail.sequence = oldTail.sequence + REFERENCE;
 		newTail.ptr = oldTail.ptr;
 	}
 	while (!atomic_compare_exchange_strong_explicit(&proxy->tail.ival, &oldTail.ival, newTail.ival, memory_order_relaxed, memory_order_relaxed));
+	TRACE3(get_ref, proxy, oldTail.ptr, retries);
 	
 	return oldTail.ptr;
 	
 }
 
-inline void _dropProxyNodeReference(stpcProxy* proxy, stpcNode* proxyNode, int adjust) {
+static void _freeDataVec(stpcProxy* proxy, void (*freeData)(void *), void **dataVec, size_t dataCount) {
+	for (size_t ndx = 0; ndx < dataCount; ndx++)
+		(*freeData)(dataVec[ndx]);
+	proxy->freeMem(dataVec);
+}
+
+/*
+ * Deferred reclamation
+ * Data released by the drop walk is freed inline up to the reclaim budget
+ * per drop, the rest is put on the thread's deferred free buffer and freed
+ * by later drops or stpcReclaimPending.  If a reclaim handler is set, all
+ * released data is handed to it instead, e.g. to queue to a reclaimer
+ * thread.  Settings are on the parent if sharded.
+ */
+static size_t _freeItem(stpcProxy *proxy, reclaimItem *item) {
+    if (item->dataVec != NULL) {
+        _freeDataVec(proxy, item->freeData, item->dataVec, item->dataCount);
+        stpcGetLocalStats(proxy)->dataFrees += item->dataCount;
+        return item->dataCount;
+    }
+    
+    (*item->freeData)(item->data);
+    if (item->freeData != &_freeShardedData)	// counted by last shard
+        stpcGetLocalStats(proxy)->dataFrees++;
+    return 1;
+}
+
+static void _handOff(stpcProxy *root, void (*handler)(void (*)(void *), void *, void *), reclaimItem *item) {
+    if (item->dataVec != NULL) {
+        for (size_t ndx = 0; ndx < item->dataCount; ndx++)
+            (*handler)(item->freeData, item->dataVec[ndx], root->reclaimArg);
+        (*handler)(root->freeMem, item->dataVec, root->reclaimArg);
+    }
+    else
+        (*handler)(item->freeData, item->data, root->reclaimArg);
+}
+
+static reclaimBuffer * _getReclaimBuffer(stpcProxy *root, bool alloc) {
+    reclaimBuffer *buffer = pthread_getspecific(root->reclaimKey);
+    
+    if (buffer == NULL && alloc) {
+        if ((buffer = root->allocMem(sizeof(reclaimBuffer))) == NULL)
+            return NULL;
+        memset(buffer, 0, sizeof(reclaimBuffer));
+        buffer->proxy = root;
+        pthread_setspecific(root->reclaimKey, buffer);
+    }
+    return buffer;
+}
+
+// false if the buffer or its grown ring can't be allocated
+static bool _pushReclaim(stpcProxy *root, reclaimItem *item) {
+    reclaimBuffer *buffer = _getReclaimBuffer(root, true);
+    reclaimItem *items;
+    size_t size;
+    
+    if (buffer == NULL)
+        return false;
+    if (buffer->count == buffer->size) {		// full, grow ring
+        size = (buffer->size > 0) ? 2 * buffer->size : RECLAIM_SIZE;
+        if ((items = root->allocMem(size * sizeof(reclaimItem))) == NULL)
+            return false;
+        for (size_t ndx = 0; ndx < buffer->count; ndx++)
+            items[ndx] = buffer->items[(buffer->head + ndx) % buffer->size];
+        if (buffer->items != NULL)
+            root->freeMem(buffer->items);
+        buffer->items = items;
+        buffer->head = 0;
+        buffer->size = size;
+    }
+    
+    buffer->items[(buffer->head + buffer->count) % buffer->size] = *item;
+    buffer->count++;
+    return true;
+}
+
+static size_t _reclaimPending(reclaimBuffer *buffer, size_t max) {
+    reclaimItem item;
+    size_t n = 0;
+    
+    while (buffer->count > 0 && (max == 0 || n < max)) {
+        item = buffer->items[buffer->head];
+        buffer->head = (buffer->head + 1) % buffer->size;
+        buffer->count--;
+        if (buffer->count > 0)
+            PREFETCH(buffer->items[buffer->head].data);
+        n += _freeItem(buffer->proxy, &item);
+    }
+    return n;
+}
+
+static void _reclaimData(stpcProxy *proxy, stpcProxy *root, reclaimItem *item, unsigned int budget, size_t *spent) {
+    void (*handler)(void (*)(void *), void *, void *) = atomic_load_explicit(&root->reclaimHandler, memory_order_acquire);
+    
+    if (handler != NULL) {
+        _handOff(root, handler, item);
+        stpcGetLocalStats(proxy)->deferredFrees += (item->dataVec != NULL) ? item->dataCount : 1;
+    }
+    else if (budget != 0 && *spent >= budget && _pushReclaim(root, item)) {
+        stpcGetLocalStats(proxy)->deferredFrees += (item->dataVec != NULL) ? item->dataCount : 1;
+    }
+    else {
+        *spent += _freeItem(proxy, item);		// over budget if it couldn't be pushed
+    }
+}
+
+void _freeReclaimBuffer(void *data) {
+    reclaimBuffer *buffer = (reclaimBuffer *)data;
+    
+    _reclaimPending(buffer, 0);			// data already unreferenced
+    if (buffer->items != NULL)
+        buffer->proxy->freeMem(buffer->items);
+    buffer->proxy->freeMem(buffer);
+}
+
+static void _deleteReclaim(stpcProxy *proxy) {
+    reclaimBuffer *buffer = _getReclaimBuffer(proxy, false);
+    
+    if (buffer != NULL) {
+        pthread_setspecific(proxy->reclaimKey, NULL);
+        _freeReclaimBuffer(buffer);
+    }
+    pthread_key_delete(proxy->reclaimKey);		// other threads' pending data is not freed
+}
+
+void stpcSetReclaimBudget(stpcProxy *proxy, unsigned int budget) {
+    atomic_store_explicit(&proxy->reclaimBudget, budget, memory_order_relaxed);
+}
+
+void stpcSetReclaimHandler(stpcProxy *proxy, void (*handler)(void (*freeData)(void *), void *data, void *arg), void *arg) {
+    proxy->reclaimArg = arg;
+    atomic_store_explicit(&proxy->reclaimHandler, handler, memory_order_release);
+}
+
+size_t stpcReclaimPending(stpcProxy *proxy, size_t max) {
+    reclaimBuffer *buffer;
+    
+    if (proxy->parent != NULL)
+        proxy = proxy->parent;
+    if ((buffer = _getReclaimBuffer(proxy, false)) == NULL)
+        return 0;
+    return _reclaimPending(buffer, max);
+}
+
+static inline void _dropProxyNodeReference(stpcProxy* proxy, stpcNode* proxyNode, int adjust) {
 	stpcNode *node = proxyNode;
 	stpcNode *next;
 	long rcount = REFERENCE - adjust;
+	int recycled = 0;
+	stpcProxy *root = (proxy->parent != NULL) ? proxy->parent : proxy;
+	unsigned int budget = atomic_load_explicit(&root->reclaimBudget, memory_order_relaxed);
+	size_t spent = 0;
+	reclaimItem item;
+	reclaimBuffer *buffer;
 	
-	while (atomic_load_explicit(&node->count, memory_order_relaxed) == rcount || atomic_sub_fetch_explicit(&node->count, rcount, memory_order_release) == 0)
+	while (atomic_load_explicit(&node->count, memory_order_relaxed) == rcount || atomic_fetch_sub_explicit(&node->count, rcount, memory_order_release) == rcount)
 	{
 		atomic_thread_fence(memory_order_release);
 		next = node->next;
 		atomic_store_explicit(&proxy->freeTail, proxy->freeTail->next, memory_order_release);
 		node = next;
+		recycled++;
+		PREFETCH(node->next);		// next node's count, overlaps with free below
         
 		// free data queued for deferred deletion
-        if (node->freeData != NULL && node->data != NULL) {
-            (*node->freeData)(node->data);
+        if (node->freeData != NULL && (node->dataVec != NULL || node->data != NULL)) {
+            item.freeData = node->freeData;
+            item.data = node->data;
+            item.dataVec = node->dataVec;
+            item.dataCount = node->dataCount;
             node->data = NULL;
+            node->dataVec = NULL;
             
-            stpcGetLocalStats(proxy)->dataFrees++;
+            _reclaimData(proxy, root, &item, budget, &spent);
         }
 		rcount = REFERENCE;
 	}
+
+	// budget left, free data deferred by earlier drops
+	if (budget != 0 && spent < budget && (buffer = _getReclaimBuffer(root, false)) != NULL)
+		_reclaimPending(buffer, budget - spent);
+
+	// nodes available, queue parked deferred deletes
+	if (recycled > 0 && atomic_load_explicit(&proxy->parked, memory_order_relaxed) != NULL)
+		_drainParked(proxy);
 }
 
 void stpcDropProxyNodeReference(stpcProxy* proxy, stpcNode* proxyNode) {
-	_dropProxyNodeReference(proxy, proxyNode, 0);
+	(void)proxy;						// tracepoint only, may compile to nothing
+	TRACE2(drop_ref, proxy, proxyNode);
+	_dropProxyNodeReference(proxyNode->proxy, proxyNode, 0);		// shard reference acquired from
 }
 
 void _queueNode(stpcProxy* proxy, stpcNode* newNode) {
@@ -206,6 +791,7 @@ void _queueNode(stpcProxy* proxy, stpcNode* newNode) {
 
 		
     newNode->count = GUARD_BIT + 2 * REFERENCE;
+    newNode->proxy = proxy;
 	
 	/*
 	 * monkey through the trees queuing trick
@@ -218,6 +804,7 @@ void _queueNode(stpcProxy* proxy, stpcNode* newNode) {
 		attempts++;
 	}
 	while (!atomic_compare_exchange_strong_explicit(&proxy->tail.ival, &oldTail.ival, newTail.ival, memory_order_acq_rel, memory_order_acquire));
+	TRACE3(queue_node, proxy, newNode, attempts);
     
 	atomic_store_explicit(&oldTail.ptr->next, newNode, memory_order_relaxed);
 	// update old node's reference count by number of acquired references, clear guard bit, and drop ref acquired from tail pointer
@@ -228,37 +815,353 @@ void _queueNode(stpcProxy* proxy, stpcNode* newNode) {
     stats->attempts += attempts;            // tail enqueue attempts
 }
 
-void stpcDeferredDelete(stpcProxy *proxy, void (*freeData)(void *), void *data, void (*backoff)(int)) {
+/*
+ * Get new node, backing off until one is available
+ */
+stpcNode* _waitNode(stpcProxy *proxy, void (*backoff)(int)) {
     stpcNode *node;
+    long start = 0;
 	int n = 0;
     
 	while ((node = _newNode(proxy, true)) == NULL) {
+		if (n == 0) {
+			start = _nanotime();
+			TRACE2(backoff, proxy, proxy->maxNodes);
+		}
 		backoff(n++);
 	}
     
+    if (n > 0) {
+        stats_t *stats = stpcGetLocalStats(proxy);
+        long nanos = _nanotime() - start;
+        stats->backoffs += n;
+        stats->blockTime += nanos;
+        TRACE3(backoff_done, proxy, n, nanos);
+    }
+    
+    return node;
+}
+
+void _deferredDelete(stpcProxy *proxy, void (*freeData)(void *), void *data, void (*backoff)(int)) {
+    stpcNode *node = _waitNode(proxy, backoff);
+    
     node->freeData = freeData;
     node->data = data;
     
     _queueNode(proxy, node);        
 }
 
+void _freeShardedData(void *arg) {
+    shardedData *sdata = (shardedData *)arg;
+    
+    if (atomic_fetch_sub_explicit(&sdata->count, 1, memory_order_acq_rel) == 1) {
+        if (sdata->dataVec != NULL)
+            _freeDataVec(sdata->proxy, sdata->freeData, sdata->dataVec, sdata->dataCount);
+        else
+            (*sdata->freeData)(sdata->data);
+        stpcGetLocalStats(sdata->proxy)->dataFrees += (sdata->dataVec != NULL) ? sdata->dataCount : 1;
+        sdata->proxy->freeMem(sdata);
+    }
+}
+
+shardedData* _newShardedData(stpcProxy *proxy, void (*freeData)(void *), void *data, void **dataVec, size_t dataCount) {
+    shardedData *sdata = proxy->allocMem(sizeof(shardedData));
+    
+    if (sdata == NULL)
+        return NULL;
+    sdata->count = proxy->nshards;
+    sdata->freeData = freeData;
+    sdata->data = data;
+    sdata->dataVec = dataVec;
+    sdata->dataCount = dataCount;
+    sdata->proxy = proxy;
+    
+    return sdata;
+}
+
+void _shardedDeferredDelete(stpcProxy *proxy, void (*freeData)(void *), void *data, void **dataVec, size_t dataCount, void (*backoff)(int)) {
+    shardedData *sdata;
+    int n = 0;
+    
+    while ((sdata = _newShardedData(proxy, freeData, data, dataVec, dataCount)) == NULL)
+        backoff(n++);		// out of memory, wait as for a node
+    
+    for (unsigned int ndx = 0; ndx < proxy->nshards; ndx++)
+        _deferredDelete(proxy->shards[ndx], &_freeShardedData, sdata, backoff);
+}
+
+void stpcDeferredDelete(stpcProxy *proxy, void (*freeData)(void *), void *data, void (*backoff)(int)) {
+    if (proxy->nshards > 0)
+        _shardedDeferredDelete(proxy, freeData, data, NULL, 0, backoff);
+    else
+        _deferredDelete(proxy, freeData, data, backoff);
+}
+
+/*
+ * Non-blocking deferred delete
+ * If no node is available the request is parked on the overflow list and
+ * queued when nodes are next recycled.  If the parked record (or sharded
+ * data) can't be allocated either, it falls back to the blocking
+ * deferred delete.
+ */
+void _pushParked(stpcProxy *proxy, parkedData *pdata) {
+    pdata->next = atomic_load_explicit(&proxy->parked, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&proxy->parked, &pdata->next, pdata, memory_order_release, memory_order_relaxed));
+}
+
+bool _tryDeferredDelete(stpcProxy *proxy, void (*freeData)(void *), void *data) {
+    stpcNode *node;
+    parkedData *pdata;
+    
+    if ((node = _newNode(proxy, true)) != NULL) {
+        node->freeData = freeData;
+        node->data = data;
+        _queueNode(proxy, node);
+        return true;
+    }
+    
+    if ((pdata = proxy->allocMem(sizeof(parkedData))) == NULL) {
+        _deferredDelete(proxy, freeData, data, &_yieldBackoff);	// can't park, block
+        return true;
+    }
+    pdata->freeData = freeData;
+    pdata->data = data;
+    pdata->parkTime = _nanotime();
+    _pushParked(proxy, pdata);
+    
+    stpcGetLocalStats(proxy)->parks++;
+    return false;
+}
+
+unsigned int _drainParked(stpcProxy *proxy) {
+    parkedData *pdata, *next;
+    stpcNode *node;
+    unsigned int n = 0;
+    bool exhausted;
+    
+    do {
+        if (atomic_exchange_explicit(&proxy->draining, true, memory_order_acquire))
+            return n;		// drain in progress
+        
+        pdata = atomic_exchange_explicit(&proxy->parked, NULL, memory_order_acquire);
+        while (pdata != NULL && (node = _newNode(proxy, true)) != NULL) {
+            next = pdata->next;
+            node->freeData = pdata->freeData;
+            node->data = pdata->data;
+            stpcGetLocalStats(proxy)->parkTime += _nanotime() - pdata->parkTime;
+            _queueNode(proxy, node);
+            proxy->freeMem(pdata);
+            pdata = next;
+            n++;
+        }
+        
+        // still no nodes, repark
+        exhausted = (pdata != NULL);
+        while (pdata != NULL) {
+            next = pdata->next;
+            _pushParked(proxy, pdata);
+            pdata = next;
+        }
+        
+        atomic_store_explicit(&proxy->draining, false, memory_order_release);
+        
+        // parked while draining and the concurrent drain attempt returned,
+        // drain again unless out of nodes (a later recycling drop drains)
+    }
+    while (!exhausted && atomic_load_explicit(&proxy->parked, memory_order_acquire) != NULL);
+    
+    return n;
+}
+
+bool stpcTryDeferredDelete(stpcProxy *proxy, void (*freeData)(void *), void *data) {
+    shardedData *sdata;
+    bool rc = true;
+    
+    if (proxy->nshards == 0)
+        return _tryDeferredDelete(proxy, freeData, data);
+    
+    if ((sdata = _newShardedData(proxy, freeData, data, NULL, 0)) == NULL) {
+        _shardedDeferredDelete(proxy, freeData, data, NULL, 0, &_yieldBackoff);	// can't be shared, block
+        return true;
+    }
+    for (unsigned int ndx = 0; ndx < proxy->nshards; ndx++)
+        if (!_tryDeferredDelete(proxy->shards[ndx], &_freeShardedData, sdata))
+            rc = false;
+    
+    return rc;
+}
+
+unsigned int stpcDrainParked(stpcProxy *proxy) {
+    unsigned int n = 0;
+    
+    for (unsigned int ndx = 0; ndx < proxy->nshards; ndx++)
+        n += _drainParked(proxy->shards[ndx]);
+    
+    return n + _drainParked(proxy);
+}
+
+/*
+ * Queue data vector on a single node, node takes ownership of the vector
+ */
+void _deferredDeleteVec(stpcProxy *proxy, void (*freeData)(void *), void **dataVec, size_t dataCount, void (*backoff)(int)) {
+    stpcNode *node;
+    
+    if (proxy->nshards > 0) {
+        _shardedDeferredDelete(proxy, freeData, NULL, dataVec, dataCount, backoff);
+        return;
+    }
+    
+    node = _waitNode(proxy, backoff);
+    node->freeData = freeData;
+    node->dataVec = dataVec;
+    node->dataCount = dataCount;
+    
+    _queueNode(proxy, node);        
+}
+
+void stpcDeferredDeleteBatch(stpcProxy *proxy, void (*freeData)(void *), void **data, size_t n, void (*backoff)(int)) {
+    void **dataVec;
+    
+    if (n == 0)
+        return;
+    
+    // no vector, queue them one per node
+    if ((dataVec = proxy->allocMem(n * sizeof(void *))) == NULL) {
+        for (size_t ndx = 0; ndx < n; ndx++)
+            stpcDeferredDelete(proxy, freeData, data[ndx], backoff);
+        return;
+    }
+    memcpy(dataVec, data, n * sizeof(void *));
+    
+    _deferredDeleteVec(proxy, freeData, dataVec, n, backoff);
+}
+
+/*
+ * Thread local retire buffer
+ */
+void _flushRetireBuffer(retireBuffer *buffer, void (*backoff)(int)) {
+    if (buffer->dataCount == 0)
+        return;
+    
+    _deferredDeleteVec(buffer->proxy, buffer->freeData, buffer->dataVec, buffer->dataCount, backoff);
+    buffer->dataVec = NULL;				// owned by node now
+    buffer->dataCount = 0;
+}
+
+static void _yieldBackoff(int n) {
+    (void)n;							// backoff signature, count unused
+    sched_yield();
+}
+
+void _freeRetireBuffer(void *data) {
+    retireBuffer *buffer = (retireBuffer *)data;
+    
+    _flushRetireBuffer(buffer, &_yieldBackoff);
+    buffer->proxy->freeMem(buffer);
+}
+
+/*
+ * Free calling thread's retire buffer and delete the key.  No references
+ * are held once the proxy is being deleted, so buffered data is freed
+ * directly.  Other threads' buffers must be flushed before the delete.
+ */
+static void _deleteRetire(stpcProxy *proxy) {
+    retireBuffer *buffer = pthread_getspecific(proxy->retireKey);
+    
+    if (buffer != NULL) {
+        pthread_setspecific(proxy->retireKey, NULL);
+        if (buffer->dataVec != NULL)
+            _freeDataVec(proxy, buffer->freeData, buffer->dataVec, buffer->dataCount);
+        proxy->freeMem(buffer);
+    }
+    pthread_key_delete(proxy->retireKey);
+}
+
+void stpcRetire(stpcProxy *proxy, void (*freeData)(void *), void *data, void (*backoff)(int)) {
+    retireBuffer *buffer = pthread_getspecific(proxy->retireKey);
+    
+    if (buffer == NULL) {
+        if ((buffer = proxy->allocMem(sizeof(retireBuffer))) == NULL) {
+            stpcDeferredDelete(proxy, freeData, data, backoff);		// unbatched
+            return;
+        }
+        memset(buffer, 0, sizeof(retireBuffer));
+        buffer->proxy = proxy;
+        pthread_setspecific(proxy->retireKey, buffer);
+    }
+    
+    if (buffer->dataCount > 0 && buffer->freeData != freeData)
+        _flushRetireBuffer(buffer, backoff);
+    
+    if (buffer->dataVec == NULL) {
+        buffer->dataSize = atomic_load_explicit(&proxy->retireThreshold, memory_order_relaxed);
+        buffer->dataVec = proxy->allocMem(buffer->dataSize * sizeof(void *));
+        if (buffer->dataVec == NULL) {
+            stpcDeferredDelete(proxy, freeData, data, backoff);		// unbatched, vector retried next time
+            return;
+        }
+    }
+    
+    buffer->freeData = freeData;
+    buffer->dataVec[buffer->dataCount++] = data;
+    
+    if (buffer->dataCount >= buffer->dataSize)
+        _flushRetireBuffer(buffer, backoff);
+}
+
+void stpcFlushRetired(stpcProxy *proxy, void (*backoff)(int)) {
+    retireBuffer *buffer = pthread_getspecific(proxy->retireKey);
+    
+    if (buffer != NULL)
+        _flushRetireBuffer(buffer, backoff);
+}
+
+void stpcSetRetireThreshold(stpcProxy *proxy, unsigned int threshold) {
+    if (threshold > 0)
+        atomic_store_explicit(&proxy->retireThreshold, threshold, memory_order_relaxed);
+}
+
 unsigned int stpcTryDeleteProxyNodes(stpcProxy *proxy, unsigned int count) {
     unsigned int n = 0;
+    
+    if (proxy->nshards > 0) {
+        for (unsigned int ndx = 0; ndx < proxy->nshards && n < count; ndx++)
+            n += stpcTryDeleteProxyNodes(proxy->shards[ndx], count - n);
+        return n;
+    }
+    
     unsigned int current = atomic_load_explicit(&proxy->numNodes, memory_order_relaxed);
     
     for (n = 0; n < count && current > 1; n++) {
         stpcNode *node = _newNode(proxy, false);
         if (node == NULL)
             break;
-        proxy->freeMem(node);
-        current = atomic_sub_fetch_explicit(&proxy->numNodes, 1, memory_order_relaxed);
+        _freeNode(proxy, node);
+        current = atomic_fetch_sub_explicit(&proxy->numNodes, 1, memory_order_relaxed) - 1;
     }
     return n;
 }
 
+/*
+ * Set maximum nodes, ignored if less than 2.  Split between shards, each
+ * shard gets at least 2 (node in use plus one to queue), so the total may
+ * exceed maxNodes if maxNodes < 2 * nshards.
+ */
 void stpcSetMaxNodes(stpcProxy *proxy, unsigned int maxNodes) {
-    if (maxNodes > 1)
-        atomic_store_explicit(&proxy->maxNodes, maxNodes, memory_order_relaxed);
+    unsigned int shardNodes;
+    
+    if (maxNodes < 2)
+        return;
+    atomic_store_explicit(&proxy->maxNodes, maxNodes, memory_order_relaxed);
+    
+    // split between shards
+    if (proxy->nshards > 0) {
+        shardNodes = maxNodes / proxy->nshards;
+        if (shardNodes < 2)
+            shardNodes = 2;
+        for (unsigned int ndx = 0; ndx < proxy->nshards; ndx++)
+            stpcSetMaxNodes(proxy->shards[ndx], shardNodes);
+    }
 }
 
 unsigned int stpcGetMaxNodes(stpcProxy *proxy) {
@@ -266,38 +1169,127 @@ unsigned int stpcGetMaxNodes(stpcProxy *proxy) {
 }
 
 unsigned int stpcGetNodeCount(stpcProxy *proxy) {
-    return atomic_load_explicit(&proxy->numNodes, memory_order_relaxed);
+    unsigned int n = 0;
+    
+    for (unsigned int ndx = 0; ndx < proxy->nshards; ndx++)
+        n += stpcGetNodeCount(proxy->shards[ndx]);
+    
+    return n + atomic_load_explicit(&proxy->numNodes, memory_order_relaxed);
 }
 
 stats_t * _allocStats(stpcProxy *proxy) {    
-    size_t sz = sizeof(stats_t);
-    stats_t *stats = (stats_t *)proxy->allocMem(sz);
-    memset(stats, 0, sz);
-    stats->proxy = proxy;
+    size_t sz = sizeof(statsBlock);
+    statsBlock *block = (statsBlock *)_allocAligned(proxy->allocMem, sz);	// per thread, own line
+    if (block == NULL)
+        return NULL;
+    memset(block, 0, sz);
+    block->stats.proxy = proxy;
+    return &block->stats;
+}
+
+/*
+ * Stats registry
+ * Per thread stats blocks are kept on a per proxy list for the life of
+ * the proxy.  A block released at thread exit is reused by the next new
+ * thread, so its counts stay in the totals.  The current thread's block
+ * for the last proxy used is cached in a __thread variable, keyed by
+ * proxy id, to avoid the pthread_getspecific lookup.
+ */
+static __thread struct {
+    unsigned long   id;
+    stats_t *       stats;
+} _statsCache;
+
+static unsigned long _proxyIds = 0;         // proxy id generator
+
+stats_t * _registerStats(stpcProxy *proxy) {
+    statsBlock *block;
+    stats_t *stats;
+    int inuse;
+    
+    for (block = atomic_load_explicit(&proxy->registry, memory_order_acquire); block != NULL; block = block->next) {
+        inuse = 0;
+        if (atomic_load_explicit(&block->inuse, memory_order_relaxed) == 0 && atomic_compare_exchange_strong_explicit(&block->inuse, &inuse, 1, memory_order_acquire, memory_order_relaxed))
+            return &block->stats;
+    }
+    
+    stats = _allocStats(proxy);
+    if (stats == NULL)
+        return &proxy->stats;       // no block, count into the snapshot block, counts may be lost
+    block = STATS_BLOCK(stats);
+    block->inuse = 1;
+    block->next = atomic_load_explicit(&proxy->registry, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&proxy->registry, &block->next, block, memory_order_release, memory_order_relaxed));
+    
     return stats;
 }
 
 void _freeStats(void *data) {
     stats_t *stats = (stats_t *)data;
-    stpcProxy *proxy = stats->proxy;
-    stats_t *pstats = &proxy->stats;
-    atomic_add_fetch_explicit(&pstats->attempts, stats->attempts, memory_order_relaxed);
-    atomic_add_fetch_explicit(&pstats->dataFrees, stats->dataFrees, memory_order_relaxed);
-    atomic_add_fetch_explicit(&pstats->tries, stats->tries, memory_order_relaxed);
-    atomic_add_fetch_explicit(&pstats->reuse, stats->reuse, memory_order_relaxed);
-    free(data);
+    
+    if (_statsCache.stats == stats)
+        _statsCache.id = 0;
+    atomic_store_explicit(&STATS_BLOCK(stats)->inuse, 0, memory_order_release);		// release for reuse
+}
+
+void _deleteStats(stpcProxy *proxy) {
+    statsBlock *block, *next;
+    
+    pthread_key_delete(proxy->statsKey);
+    for (block = proxy->registry; block != NULL; block = next) {
+        next = block->next;
+        _freeAligned(proxy->freeMem, block);
+    }
+    proxy->registry = NULL;
+    _statsCache.id = 0;
 }
 
 stats_t * stpcGetLocalStats(stpcProxy *proxy) {
+    if (proxy->parent != NULL)
+        proxy = proxy->parent;
+    if (_statsCache.id == proxy->id)
+        return _statsCache.stats;
+    
     stats_t *stats = pthread_getspecific(proxy->statsKey);
     if (stats == NULL) {
-        stats = _allocStats(proxy);
-        pthread_setspecific(proxy->statsKey, stats);        
+        stats = _registerStats(proxy);
+        if (stats != &proxy->stats)     // snapshot block has no registry links
+            pthread_setspecific(proxy->statsKey, stats);        
     }
+    
+    _statsCache.id = proxy->id;
+    _statsCache.stats = stats;
     return stats;
 }
 
+/*
+ * Sum live and exited threads' stats without stopping them
+ */
+void stpcGetStatsSnapshot(stpcProxy *proxy, stats_t *out) {
+    statsBlock *block;
+    stats_t *stats;
+    if (proxy->parent != NULL)
+        proxy = proxy->parent;
+    memset(out, 0, sizeof(stats_t));
+    out->proxy = proxy;
+    for (block = atomic_load_explicit(&proxy->registry, memory_order_acquire); block != NULL; block = block->next) {
+        stats = &block->stats;
+        out->tries += atomic_load_explicit(&stats->tries, memory_order_relaxed);
+        out->attempts += atomic_load_explicit(&stats->attempts, memory_order_relaxed);
+        out->reuse += atomic_load_explicit(&stats->reuse, memory_order_relaxed);
+        out->dataFrees += atomic_load_explicit(&stats->dataFrees, memory_order_relaxed);
+        out->parks += atomic_load_explicit(&stats->parks, memory_order_relaxed);
+        out->backoffs += atomic_load_explicit(&stats->backoffs, memory_order_relaxed);
+        out->blockTime += atomic_load_explicit(&stats->blockTime, memory_order_relaxed);
+        out->parkTime += atomic_load_explicit(&stats->parkTime, memory_order_relaxed);
+        out->deferredFrees += atomic_load_explicit(&stats->deferredFrees, memory_order_relaxed);
+    }
+}
+
 stats_t * stpcGetStats(stpcProxy *proxy) {
+    if (proxy->parent != NULL)
+        proxy = proxy->parent;
+    stpcGetStatsSnapshot(proxy, &proxy->stats);
     return &proxy->stats;
 }
 
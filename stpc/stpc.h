@@ -17,36 +17,81 @@
 #ifndef STPDR_H_
 #define STPDR_H_
 
+#ifndef __cplusplus
 #include <stdatomic.h>
+#endif
 #include <stdbool.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct _stpcNode stpcNode;
 typedef struct _stpcProxy stpcProxy;
 
+/*
+ * Counts are bumped with plain increments by the owning thread and summed
+ * with relaxed loads, so a snapshot of running threads is approximate.
+ * Aligned long updates don't tear on the supported 64 bit targets.
+ */
 typedef struct _stats_t {
     stpcProxy *proxy;
     long    tries;          // # calls to _addNode
     long    attempts;       // # attempts to queue node onto tail node
     long    reuse;          // # node reuse/recyling
     long    dataFrees;      // # dataFrees
+    long    parks;          // # deferred deletes parked, no nodes available
+    long    backoffs;       // # backoff calls, no nodes available
+    long    blockTime;      // time blocked in backoff (nsecs)
+    long    parkTime;       // time parked deletes waited for a node (nsecs)
+    long    deferredFrees;  // # dataFrees deferred past reclaim budget or handed off
 } stats_t;
 
 extern stats_t * stpcGetLocalStats(stpcProxy *proxy);
-extern stats_t * stpcGetStats(stpcProxy *proxy);
+extern stats_t * stpcGetStats(stpcProxy *proxy);        // snapshot into proxy's stats
+extern void stpcGetStatsSnapshot(stpcProxy *proxy, stats_t *out);
 
 extern stpcProxy *stpcNewProxy();
 extern stpcProxy * stpcNewProxyM(void *(allocMem)(size_t), void (*freeMem)(void *));
 extern int stpcDeleteProxy(stpcProxy *proxy);
 
-extern void stpcSetMaxNodes(stpcProxy *proxy, unsigned int maxNodes); // set before initProxy
+// arena proxy, nodes carved from slabs, maxNodes nodes preallocated if bounded
+extern stpcProxy *stpcNewProxyArena(unsigned int nodesPerSlab, unsigned int maxNodes);
+extern stpcProxy *stpcNewProxyArenaM(unsigned int nodesPerSlab, unsigned int maxNodes, void *(allocMem)(size_t), void (*freeMem)(void *));
+
+// sharded proxy, one tail per shard selected by current cpu
+extern stpcProxy *stpcNewShardedProxy(unsigned int nshards);
+extern stpcProxy *stpcNewShardedProxyM(unsigned int nshards, void *(allocMem)(size_t), void (*freeMem)(void *));
+extern unsigned int stpcGetShardCount(stpcProxy *proxy);
+
+extern void stpcSetMaxNodes(stpcProxy *proxy, unsigned int maxNodes); // set before initProxy, split between shards, at least 2 per shard
 extern unsigned int stpcGetMaxNodes(stpcProxy *proxy);
 extern unsigned int stpcGetNodeCount(stpcProxy *proxy);
 
 extern stpcNode *stpcGetProxyNodeReference(stpcProxy *proxy);
 extern void stpcDropProxyNodeReference(stpcProxy* proxy, stpcNode* node);
 extern void stpcDeferredDelete(stpcProxy *proxy, void (*freeData)(void *), void *data, void (*backoff)(int));
+// non-blocking, returns false if parked until nodes are recycled, blocks
+// as stpcDeferredDelete if the parked record can't be allocated
+extern bool stpcTryDeferredDelete(stpcProxy *proxy, void (*freeData)(void *), void *data);
+extern unsigned int stpcDrainParked(stpcProxy *proxy);
+extern void stpcDeferredDeleteBatch(stpcProxy *proxy, void (*freeData)(void *), void **data, size_t n, void (*backoff)(int));
+
+// thread local retire buffer, flushed as one batch at threshold
+extern void stpcRetire(stpcProxy *proxy, void (*freeData)(void *), void *data, void (*backoff)(int));
+extern void stpcFlushRetired(stpcProxy *proxy, void (*backoff)(int));
+extern void stpcSetRetireThreshold(stpcProxy *proxy, unsigned int threshold);
+
+// deferred reclamation, limit frees done inline by a releasing reader
+extern void stpcSetReclaimBudget(stpcProxy *proxy, unsigned int budget);	// 0 unlimited (default)
+extern void stpcSetReclaimHandler(stpcProxy *proxy, void (*handler)(void (*freeData)(void *), void *data, void *arg), void *arg);
+extern size_t stpcReclaimPending(stpcProxy *proxy, size_t max);		// free thread's deferred data, 0 all
 
 extern unsigned int stpcTryDeleteProxyNodes(stpcProxy *proxy, unsigned int count);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* STPDR_H_ */
@@ -0,0 +1,151 @@
+/*
+   Copyright 2013 Joseph W. Seigh
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+
+//------------------------------------------------------------------------------
+// stpc.hpp -- C++ proxy, guard and typed deferred delete over stpc
+//
+//   stpc::proxy owns a stpcProxy, stpc::guard holds a proxy node reference for
+// its scope, and proxy::retire<T, Deleter>(T *) defers deletion of an object
+// until all guards acquired before the retire are released.  The free
+// function handed to the C library is instantiated per T and Deleter so
+// the deleter call inlines into it.
+//
+//   stpc.hpp and rcpc.hpp have the same interface in their own namespace.
+// Only one of them can be used per translation unit (the C headers share
+// a header guard and stats_t), so select the algorithm with a namespace
+// alias, e.g.
+//
+//     #include <stpc.hpp>
+//     namespace pc = stpc;
+//
+//     pc::proxy proxy;
+//     { pc::guard g(proxy); ... }
+//     proxy.retire(old);
+//
+//------------------------------------------------------------------------------
+
+#ifndef STPC_HPP
+#define STPC_HPP
+
+#include <sched.h>
+#include <memory>
+
+#include "stpc.h"
+
+namespace stpc {
+
+//-----------------------------------------------------------------------------
+// yield_backoff -- default backoff while no proxy nodes available
+//-----------------------------------------------------------------------------
+inline void yield_backoff(int) {
+	sched_yield();
+}
+
+//=============================================================================
+// proxy -- stpcProxy owner and typed deferred delete
+//=============================================================================
+class proxy {
+	public:
+		proxy() {
+			p = stpcNewProxy();
+		}
+
+		// adopt configured proxy, e.g. stpcNewShardedProxy, stpcNewProxyArena
+		explicit proxy(stpcProxy * src) {
+			p = src;
+		}
+
+		~proxy() {
+			stpcDeleteProxy(p);
+		}
+
+		stpcProxy * get() { return p; }
+
+		//-----------------------------------------------------------------
+		// retire -- deferred delete, backs off while no nodes available
+		//-----------------------------------------------------------------
+		template<typename T, typename Deleter = std::default_delete<T>>
+		void retire(T * obj, void (*backoff)(int) = &yield_backoff) {
+			stpcDeferredDelete(p, &freeData<T, Deleter>, (void *)obj, backoff);
+		}
+
+		//-----------------------------------------------------------------
+		// try_retire -- non-blocking deferred delete, false if parked
+		//-----------------------------------------------------------------
+		template<typename T, typename Deleter = std::default_delete<T>>
+		bool try_retire(T * obj) {
+			return stpcTryDeferredDelete(p, &freeData<T, Deleter>, (void *)obj);
+		}
+
+		//-----------------------------------------------------------------
+		// retire_batched -- deferred delete through the thread local
+		// retire buffer, see flush
+		//-----------------------------------------------------------------
+		template<typename T, typename Deleter = std::default_delete<T>>
+		void retire_batched(T * obj, void (*backoff)(int) = &yield_backoff) {
+			stpcRetire(p, &freeData<T, Deleter>, (void *)obj, backoff);
+		}
+
+		void flush(void (*backoff)(int) = &yield_backoff) {
+			stpcFlushRetired(p, backoff);
+		}
+
+		stats_t * stats() { return stpcGetStats(p); }
+
+	private:
+		template<typename T, typename Deleter>
+		static void freeData(void * data) {
+			Deleter()((T *)data);
+		}
+
+		proxy(const proxy &);
+		proxy & operator = (const proxy &);
+
+		stpcProxy *	p;
+
+}; // class proxy
+
+
+//=============================================================================
+// guard -- scoped proxy node reference
+//=============================================================================
+class guard {
+	public:
+		guard(proxy & src) : px(src) {
+			node = stpcGetProxyNodeReference(px.get());
+		}
+
+		~guard() {
+			stpcDropProxyNodeReference(px.get(), node);
+		}
+
+	private:
+		void * operator new (size_t);		// auto only
+
+		guard(const guard &);
+		guard & operator = (const guard &);
+
+		proxy &		px;
+		stpcNode *	node;
+
+}; // class guard
+
+} // namespace stpc
+
+#endif /* STPC_HPP */
+
+
+/*-*/